@@ -0,0 +1,60 @@
+#include "BenchFormula.h"
+#include "BenchFold.h"
+#include "BenchColumn.h"
+#include "BenchCopy.h"
+#include "BenchGrid.h"
+#include "BenchLiterals.h"
+#include "BenchArena.h"
+#include "BenchSnapshot.h"
+#include "BenchBatch.h"
+#include "BenchParallel.h"
+#include "BenchFill.h"
+#include "BenchUndo.h"
+#include "BenchParser.h"
+#include "BenchParseCache.h"
+#include "BenchLiteralInput.h"
+#include <algorithm>
+#include <cstdlib>
+#include <new>
+
+// Count every heap allocation of the benchmarks (see countAllocations). All replaced operators
+// go through this pair, kept out of line so the compiler never pairs an inlined library
+// operator with malloc or free; the sized deletes are not replaced, they forward to these.
+[[gnu::noinline]] static void *allocate(size_t size, size_t align) {
+    g_Allocations.fetch_add(1, memory_order_relaxed);
+    size = size ? size : 1;
+    void *ptr = align <= alignof(max_align_t) ? malloc(size)
+                                              : aligned_alloc(align, (size + align - 1) / align * align);
+    if (!ptr)
+        throw bad_alloc();
+    return ptr;
+}
+
+[[gnu::noinline]] static void release(void *ptr) noexcept { free(ptr); }
+
+void *operator new(size_t size) { return allocate(size, 0); }
+void operator delete(void *ptr) noexcept { release(ptr); }
+
+// Aligned allocations, e.g. by the default memory resource of pmr containers
+void *operator new(size_t size, align_val_t alignment) { return allocate(size, max((size_t) alignment, sizeof(void *))); }
+void operator delete(void *ptr, align_val_t) noexcept { release(ptr); }
+
+int main() {
+    // Benchmarks of the evaluation engine (build with make bench)
+    BenchFormula();
+    BenchFold();
+    BenchColumn();
+    BenchCopy();
+    BenchGrid();
+    BenchLiterals();
+    BenchArena();
+    BenchSnapshot();
+    BenchBatch();
+    BenchParallel();
+    BenchFill();
+    BenchUndo();
+    BenchParser();
+    BenchParseCache();
+    BenchLiteralInput();
+    return EXIT_SUCCESS;
+}
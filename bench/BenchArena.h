@@ -0,0 +1,74 @@
+#pragma once
+#include "BenchUtils.h"
+#include "../src/CSpreadsheet.h"
+#include "NodeBuilder.h"
+#include <map>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/* Loading, editing and destroying a sheet of formulas that all differ, so none of them
+ * share instructions: the cost of allocating and releasing the instructions of every cell,
+ * compared to the map of expression nodes the sheet stored before (see NodeBuilder.h).
+ * The sheet also links every cell into the dependency graph, whose sets of precedents and
+ * dependents allocate apart from the formulas. */
+class BenchArena {
+public:
+    BenchArena() {
+        cout << "== Sheet of " << ROWS << " distinct formulas: expression nodes vs arena" << endl;
+
+        // The formulas of column B refer to column A at growing distances
+        stringstream saved;
+        {
+            CSpreadsheet sheet;
+            for (int row = 0; row < ROWS; row++)
+                sheet.setCell(CPos(1, row), "=A" + to_string(row % 1000 + 1) + "*" + to_string(row) + "+$C$1");
+            sheet.save(saved);
+        }
+        string text = saved.str();
+
+        CRun nodes = run<map<CPos, vector<AExpr> > >(text, [](map<CPos, vector<AExpr> > &cells, istream &is) { loadNodes(is, cells); },
+                         [](map<CPos, vector<AExpr> > &cells, CPos pos, const string &contents) {
+                             CNodeBuilder builder;
+                             parseExpression(contents, builder);
+                             cells[pos] = std::move(builder.m_Nodes);
+                         });
+        CRun arena = run<CSpreadsheet>(text, [](CSpreadsheet &sheet, istream &is) { sheet.load(is); },
+                         [](CSpreadsheet &sheet, CPos pos, const string &contents) { sheet.setCell(pos, contents); });
+
+        report("load", "ms", nodes.m_LoadMs, arena.m_LoadMs);
+        report("allocations per loaded cell", "", nodes.m_LoadAllocations / ROWS, arena.m_LoadAllocations / ROWS);
+        report("setCell", "ms", nodes.m_EditMs, arena.m_EditMs);
+        report("allocations per edited cell", "", nodes.m_EditAllocations / ROWS, arena.m_EditAllocations / ROWS);
+        report("teardown", "ms", nodes.m_TeardownMs, arena.m_TeardownMs);
+    }
+
+private:
+    static constexpr int ROWS = 200000;
+
+    struct CRun {
+        double m_LoadMs, m_LoadAllocations, m_EditMs, m_EditAllocations, m_TeardownMs;
+    };
+
+    // Load the saved cells into a new TCells, edit a column of formulas reading them, destroy it
+    template <class TCells, class FLoad, class FEdit>
+    static CRun run(const string &text, FLoad &&load, FEdit &&edit) {
+        CRun result{};
+        auto cells = make_unique<TCells>();
+        result.m_LoadMs = measureMs([&] {
+            istringstream is(text);
+            result.m_LoadAllocations = countAllocations([&] { load(*cells, is); }, 1);
+        });
+        result.m_EditMs = measureMs([&] {
+            result.m_EditAllocations = countAllocations([&] {
+                for (int row = 0; row < ROWS; row++)
+                    edit(*cells, CPos(2, row + 2), "=B" + to_string(row + 1) + "-" + to_string(row));
+            }, 1);
+        });
+        result.m_TeardownMs = measureMs([&] { cells.reset(); });
+        return result;
+    }
+};
@@ -0,0 +1,61 @@
+#pragma once
+#include "BenchUtils.h"
+#include "../src/CSpreadsheet.h"
+#include <string>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+/* Ingest of 200k cells, half of them formulas reading the cell to the left and the cell
+ * above: setCell for every cell and a recalculation, compared to one setCells batch. */
+class BenchBatch {
+public:
+    BenchBatch() {
+        cout << "== Ingest of " << COLS << " x " << ROWS << " cells: setCell vs setCells" << endl;
+
+        vector<pair<CPos, string> > cells;
+        cells.reserve((size_t) COLS * ROWS);
+        for (int row = 1; row <= ROWS; row++)
+            for (int col = 0; col < COLS; col++)
+                cells.emplace_back(CPos(col, row), col % 2 ? "=" + columnName(col - 1) + to_string(row) + "+"
+                                                             + columnName(col) + to_string(max(row - 1, 1))
+                                                           : to_string(row + col));
+
+        double singleAllocations, batchAllocations;
+        double singleMs, batchMs;
+        CValue singleValue, batchValue;
+        {
+            CSpreadsheet sheet;
+            singleAllocations = countAllocations([&] {
+                singleMs = measureMs([&] {
+                    for (const auto &[pos, contents]: cells)
+                        sheet.setCell(pos, contents);
+                    sheet.recalculate();
+                });
+            }, 1);
+            singleValue = sheet.getValue(CPos(COLS - 1, ROWS));
+        }
+        {
+            CSpreadsheet sheet;
+            batchAllocations = countAllocations([&] {
+                batchMs = measureMs([&] { sheet.setCells(cells); });
+            }, 1);
+            batchValue = sheet.getValue(CPos(COLS - 1, ROWS));
+        }
+        keepValue(singleValue == batchValue);
+
+        report("ingest", "ms", singleMs, batchMs);
+        report("allocations per cell", "", singleAllocations / (double) cells.size(),
+               batchAllocations / (double) cells.size());
+    }
+
+private:
+    static constexpr int COLS = 20;
+    static constexpr int ROWS = 10000;
+
+    static string columnName(int col) {
+        char letters[CPos::COLUMN_LETTERS];
+        return string(letters, CPos::columnLetters(col, letters));
+    }
+};
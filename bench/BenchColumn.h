@@ -0,0 +1,68 @@
+#pragma once
+#include "BenchUtils.h"
+#include "../src/CColumnKernel.h"
+#include "../src/CSpreadsheet.h"
+#include <random>
+#include <vector>
+
+using namespace std;
+
+/* Batch evaluation of formulas copied down a column: one CColumnKernel call over columns
+ * of operands, scalar applyNumbers compared to the widest vector instruction set. Then end
+ * to end in a sheet: a column filled by copyRect read cell by cell, each dirty cell evaluated
+ * alone, compared to recalculate evaluating the column in batches. */
+class BenchColumn {
+public:
+    BenchColumn() {
+        cout << "== Column kernels: scalar vs " << (CColumnKernel::best() == CColumnKernel::EInstructionSet::Avx2 ? "AVX2" : "SSE2")
+             << " (ns per " << COUNT << " cells)" << endl;
+
+        mt19937 random(1);
+        uniform_real_distribution<double> numbers(-1000, 1000);
+        vector<double> lhs(COUNT), rhs(COUNT), out(COUNT);
+        vector<uint8_t> failed(COUNT);
+        for (size_t i = 0; i < COUNT; i++) {
+            lhs[i] = numbers(random);
+            rhs[i] = numbers(random);
+        }
+
+        for (auto [name, op]: {pair<const char *, EOpcode>{"=A1+B1", EOpcode::Add}, {"=A1*B1", EOpcode::Mul},
+                               {"=A1/B1", EOpcode::Div}, {"=A1<B1", EOpcode::Lt}, {"=A1^B1", EOpcode::Pow}}) {
+            auto run = [&](CColumnKernel::EInstructionSet set) {
+                return measureNs([&] {
+                    CColumnKernel::apply(op, lhs.data(), rhs.data(), out.data(), failed.data(), COUNT, set);
+                    keepValue(out);
+                }, REPEATS);
+            };
+            report(name, "ns", run(CColumnKernel::EInstructionSet::Scalar), run(CColumnKernel::best()));
+        }
+
+        cout << "== Column of " << ROWS << " formulas filled by copyRect: getValue cell by cell vs recalculate" << endl;
+        CSpreadsheet sheet;
+        for (int row = 1; row <= ROWS; row++)
+            sheet.setCell(CPos(0, row), to_string(row * 0.25));
+        sheet.setCell(CPos("B1"), "=A1*$C$1");
+        for (int rows = 1; rows < ROWS; rows *= 2)
+            sheet.copyRect(CPos(1, rows + 1), CPos("B1"), 1, min(rows, ROWS - rows));
+
+        // Every edit of C1 makes the whole column dirty
+        double single = 0, batched = 0;
+        for (int i = 0; i < RECALCULATIONS; i++) {
+            sheet.setCell(CPos("C1"), to_string(i + 2));
+            single += measureMs([&] {
+                for (int row = 1; row <= ROWS; row++)
+                    keepValue(sheet.getValue(CPos(1, row)));
+            });
+            sheet.setCell(CPos("C1"), to_string(i + 3));
+            batched += measureMs([&] { sheet.recalculate(); });
+            keepValue(sheet.getValue(CPos(1, ROWS)));
+        }
+        report("ns per cell", "ns", single * 1e6 / RECALCULATIONS / ROWS, batched * 1e6 / RECALCULATIONS / ROWS);
+    }
+
+private:
+    static constexpr int ROWS = 100000;
+    static constexpr int RECALCULATIONS = 10;
+    static constexpr size_t COUNT = 4096;
+    static constexpr size_t REPEATS = 2000;
+};
@@ -0,0 +1,74 @@
+#pragma once
+#include "BenchUtils.h"
+#include "../src/CSpreadsheet.h"
+#include "../tests/CExprNodes.h"
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/* Filling a column by copyRect: the copies share the instructions of the source formula,
+ * a moved copy costs a handle instead of a deep clone of every node of the expression tree
+ * the formulas were stored as before (see tests/CExprNodes.h). */
+class BenchCopy {
+public:
+    BenchCopy() {
+        cout << "== Fill of " << ROWS << " rows by copyRect" << endl;
+
+        CStringPool strings;
+        CParser parser;
+        parser.parse("=A1*$C$1+B1/2-(A1>B1)", strings);
+        CFormula formula = parser.takeFormula();
+
+        // The same formula as postfix expression nodes
+        vector<AExpr> nodes;
+        nodes.push_back(make_unique<CReference>("A1"));
+        nodes.push_back(make_unique<CReference>("$C$1"));
+        nodes.push_back(make_unique<CMul>());
+        nodes.push_back(make_unique<CReference>("B1"));
+        nodes.push_back(make_unique<CNumber>(2));
+        nodes.push_back(make_unique<CDiv>());
+        nodes.push_back(make_unique<CAdd>());
+        nodes.push_back(make_unique<CReference>("A1"));
+        nodes.push_back(make_unique<CReference>("B1"));
+        nodes.push_back(make_unique<CGt>());
+        nodes.push_back(make_unique<CSub>());
+
+        // Moved copies: cloned nodes with shifted positions compared to shared instructions
+        vector<vector<AExpr> > clonedNodes(ROWS);
+        vector<CFormula> copiedFormulas(ROWS);
+        double cloneMs = measureMs([&] {
+            for (int row = 0; row < ROWS; row++) {
+                clonedNodes[row] = copyExpressions(nodes);
+                for (auto &node: clonedNodes[row])
+                    node->changePosition(0, row);
+            }
+        });
+        double formulaMs = measureMs([&] {
+            for (int row = 0; row < ROWS; row++) {
+                copiedFormulas[row] = formula;
+                copiedFormulas[row].changePosition(0, row);
+            }
+        });
+        report("clone nodes / copy formula", "ms", cloneMs, formulaMs);
+
+        CSpreadsheet sheet;
+        sheet.setCell(CPos("A1"), "1");
+        sheet.setCell(CPos("B1"), "2");
+        sheet.setCell(CPos("C1"), "3");
+        sheet.setCell(CPos("D1"), "=A1*$C$1+B1/2-(A1>B1)");
+        double allocations = 0;
+        double fillMs = measureMs([&] {
+            allocations = countAllocations([&] {
+                for (int rows = 1; rows < ROWS; rows *= 2)
+                    sheet.copyRect(CPos(3, rows + 1), CPos("D1"), 1, min(rows, ROWS - rows));
+            }, 1);
+        });
+        reportValue("fill", "ms", fillMs);
+        reportValue("allocations per copied cell", "", allocations / (ROWS - 1));
+    }
+
+private:
+    static constexpr int ROWS = 100000;
+};
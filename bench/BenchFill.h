@@ -0,0 +1,49 @@
+#pragma once
+#include "BenchUtils.h"
+#include "../src/CSpreadsheet.h"
+#include <algorithm>
+
+using namespace std;
+
+/* Fill of one column of 1M rows with a formula: copyRect doubling the filled block (each
+ * copy reads the rows copied by the previous one) compared to one fillRect. */
+class BenchFill {
+public:
+    BenchFill() {
+        cout << "== Fill of 1 x " << ROWS << " cells: copyRect vs fillRect" << endl;
+
+        double copyMs, fillMs, copyAllocations, fillAllocations;
+        CValue copyValue, fillValue;
+        {
+            CSpreadsheet sheet = source();
+            copyAllocations = countAllocations([&] {
+                copyMs = measureMs([&] {
+                    for (int rows = 1; rows < ROWS; rows *= 2)
+                        sheet.copyRect(CPos(0, rows + 1), CPos("A2"), 1, min(rows, ROWS - rows));
+                });
+            }, 1);
+            copyValue = sheet.getValue(CPos(0, ROWS));
+        }
+        {
+            CSpreadsheet sheet = source();
+            fillAllocations = countAllocations([&] {
+                fillMs = measureMs([&] { sheet.fillRect(CPos("A3"), CPos("A2"), 1, ROWS - 2); });
+            }, 1);
+            fillValue = sheet.getValue(CPos(0, ROWS));
+        }
+        keepValue(copyValue == fillValue);
+
+        report("fill", "ms", copyMs, fillMs);
+        report("allocations per cell", "", copyAllocations / ROWS, fillAllocations / ROWS);
+    }
+
+private:
+    static constexpr int ROWS = 1000000;
+
+    static CSpreadsheet source() {
+        CSpreadsheet sheet;
+        sheet.setCell(CPos("A1"), "1");
+        sheet.setCell(CPos("A2"), "=A1*2-A1+1");
+        return sheet;
+    }
+};
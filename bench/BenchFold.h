@@ -0,0 +1,66 @@
+#pragma once
+#include "BenchUtils.h"
+#include "../src/CSpreadsheet.h"
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/* Constant folding on a large imported sheet: the instructions of the saved formulas
+ * compared to the instructions left after load() folded them. */
+class BenchFold {
+public:
+    BenchFold() {
+        cout << "== Constant folding of an imported sheet (" << ROWS << " rows)" << endl;
+
+        // Typical formulas with constant parts, saved without folding
+        vector<string> formulas{"=2^10*3+A1", "=A1*(1+1/4)-0", "=(A1*1)*(60*60*24)",
+                                "=\"id-\"+\"x\"=A1", "=-(-(A1*2))+B1"};
+        CStringPool strings;
+        CParser parser;
+        ostringstream saved;
+        size_t before = 0;
+        for (int row = 1; row <= ROWS; row++) {
+            CPos pos("A1");
+            pos.setRow(row);
+            saved << pos << " VectorLen 1  12 " << row << " ";
+            before++;
+
+            for (size_t i = 0; i < formulas.size(); i++) {
+                string text = formulas[i];
+                for (size_t at = text.find("A1"); at != string::npos; at = text.find("A1", at + 1))
+                    text.replace(at, 2, "A" + to_string(row));
+                parser.parse(text, strings);
+                CFormula formula = parser.takeFormula();
+
+                CPos cell("B1");
+                cell.setCol((int) i + 1);
+                cell.setRow(row);
+                saved << cell << " VectorLen " << formula.size() << " " << formula;
+                before += formula.size();
+            }
+        }
+
+        CSpreadsheet sheet;
+        istringstream is(saved.str());
+        double loadMs = measureMs([&] { sheet.load(is); });
+        double recalculateMs = measureMs([&] { sheet.recalculate(); });
+
+        // Count the folded instructions in the saved sheet
+        ostringstream folded;
+        sheet.save(folded);
+        istringstream counted(folded.str());
+        size_t after = 0;
+        for (string token; counted >> token;)
+            if (token == "VectorLen" && counted >> token)
+                after += stoul(token);
+
+        report("instructions saved / folded", "", (double) before, (double) after);
+        reportValue("load", "ms", loadMs);
+        reportValue("recalculate", "ms", recalculateMs);
+    }
+
+private:
+    static constexpr int ROWS = 20000;
+};
@@ -0,0 +1,83 @@
+#pragma once
+#include "BenchUtils.h"
+#include "../src/CSpreadsheet.h"
+#include "NodeBuilder.h"
+#include <map>
+
+using namespace std;
+
+/* Evaluation of the same formulas as CExpr nodes (one virtual call per node) and as
+ * compiled CFormula instructions, each on a stack of values reused between evaluations. */
+class BenchFormula {
+public:
+    BenchFormula() {
+        cout << "== Formula evaluation: CExpr nodes vs CFormula (ns per evaluation)" << endl;
+
+        CSpreadsheet sheet;
+        sheet.setCell(CPos("A1"), "3");
+        sheet.setCell(CPos("B1"), "4.5");
+        sheet.setCell(CPos("C1"), "-2");
+        // Cached values the way the sheet stores them
+        CStringPool strings;
+        map<CPos, CCellValue> cells;
+        for (const char *name: {"A1", "B1", "C1"})
+            cells[CPos(name)] = CCellValue::fromValue(sheet.getValue(CPos(name)), strings);
+
+        for (const char *formula: {"=A1+B1", "=A1*2+B1/4-C1", "=(A1+1)^2>=B1*C1", "= -A1 ^ 2 - B1 / 2",
+                                   "=1+2*3-4/5+6^2", "=\"Total: \"+A1"})
+            compare(sheet, cells, formula);
+
+        cout << "== Common formula shapes: CExpr nodes vs CFormula (ns per evaluation)" << endl;
+        for (const char *formula: {"=A1+B1", "=A1*$C$1", "=A1-1", "=A1>B1", "=2^B1"})
+            compare(sheet, cells, formula);
+
+        cout << "== Heap allocations per CFormula evaluation" << endl;
+        for (const char *formula: {"=A1*2+B1/4-C1", "=(A1+1)^2>=B1*C1", "=\"Total: \"+A1"})
+            allocations(cells, formula);
+    }
+
+private:
+    static constexpr size_t REPEATS = 1000000;
+
+    static void compare(CSpreadsheet &sheet, const map<CPos, CCellValue> &cells, const string &text) {
+        CNodeBuilder nodeBuilder;
+        parseExpression(text, nodeBuilder);
+        CStringPool strings;
+        CParser parser;
+        parser.parse(text, strings);
+        CFormula formula = parser.takeFormula();
+
+        vector<CValue> values;
+        double nodes = measureNs([&] {
+            values.clear();
+            for (const auto &node: nodeBuilder.m_Nodes)
+                if (!node->getValue(sheet, values))
+                    break;
+            keepValue(values);
+        }, REPEATS);
+
+        auto readCell = [&cells](CPos pos) { return cells.find(pos)->second; };
+        double compiled = measureNs([&] {
+            CValue value = formula.evaluate(readCell);
+            keepValue(value);
+        }, REPEATS);
+
+        report(text, "ns", nodes, compiled);
+    }
+
+    // Numeric formulas must not allocate at all; string results allocate only the returned value
+    static void allocations(const map<CPos, CCellValue> &cells, const string &text) {
+        CStringPool strings;
+        CParser parser;
+        parser.parse(text, strings);
+        CFormula formula = parser.takeFormula();
+        auto readCell = [&cells](CPos pos) { return cells.find(pos)->second; };
+
+        double count = countAllocations([&] {
+            CValue value = formula.evaluate(readCell);
+            keepValue(value);
+        }, REPEATS);
+
+        reportValue(text, "allocations", count);
+    }
+};
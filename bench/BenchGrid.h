@@ -0,0 +1,79 @@
+#pragma once
+#include "BenchUtils.h"
+#include "../src/CGrid.h"
+#include <map>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+/* Cell storage engines on 10M cells: the ordered map the sheet used before compared to the
+ * tiled CGrid, for filling a block of columns, random lookups and a scan of all cells. */
+class BenchGrid {
+public:
+    BenchGrid() {
+        cout << "== Cell storage: map vs tiled grid (" << COLS << " x " << ROWS << " cells)" << endl;
+
+        vector<CPos> lookups;
+        mt19937 random(1);
+        for (int i = 0; i < LOOKUPS; i++)
+            lookups.emplace_back((int) (random() % COLS), (int) (random() % ROWS) + 1);
+
+        double mapFill, mapFind, mapScan, mapAllocations;
+        {
+            map<CPos, double> cells;
+            mapAllocations = countAllocations([&] {
+                mapFill = measureMs([&] { fill([&](CPos pos) -> double & { return cells[pos]; }); });
+            }, 1);
+            mapFind = measureMs([&] {
+                double sum = 0;
+                for (const auto &pos: lookups)
+                    sum += cells.find(pos)->second;
+                keepValue(sum);
+            });
+            mapScan = measureMs([&] {
+                double sum = 0;
+                for (const auto &pair: cells)
+                    sum += pair.second;
+                keepValue(sum);
+            });
+        }
+
+        double gridFill, gridFind, gridScan, gridAllocations;
+        {
+            CGrid<double> cells;
+            gridAllocations = countAllocations([&] {
+                gridFill = measureMs([&] { fill([&](CPos pos) -> double & { return cells[pos]; }); });
+            }, 1);
+            gridFind = measureMs([&] {
+                double sum = 0;
+                for (const auto &pos: lookups)
+                    sum += *cells.find(pos);
+                keepValue(sum);
+            });
+            gridScan = measureMs([&] {
+                double sum = 0;
+                cells.forEach([&sum](CPos, double value) { sum += value; });
+                keepValue(sum);
+            });
+        }
+
+        report("fill", "ms", mapFill, gridFill);
+        report("random access (" + to_string(LOOKUPS / 1000000) + "M lookups)", "ms", mapFind, gridFind);
+        report("sequential scan", "ms", mapScan, gridScan);
+        report("allocations", "", mapAllocations, gridAllocations);
+    }
+
+private:
+    static constexpr int COLS = 10;
+    static constexpr int ROWS = 1000000;
+    static constexpr int LOOKUPS = 5000000;
+
+    // Write every cell of the block, column by column as a fill down would
+    template <class F>
+    static void fill(F &&cell) {
+        for (int col = 0; col < COLS; col++)
+            for (int row = 1; row <= ROWS; row++)
+                cell(CPos(col, row)) = row;
+    }
+};
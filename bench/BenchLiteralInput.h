@@ -0,0 +1,86 @@
+#pragma once
+#include "BenchUtils.h"
+#include "../src/CParser.h"
+#include "ExpressionBuilder.h"
+#include <bit>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/* Contents of 200000 literal cells (integers, decimals, negative and exponent numbers, text):
+ * compiling them into a formula and folding it, as setCell did, compared to the classifier
+ * CParser::parseLiteral taking the value directly. The values are checked against
+ * parseExpression of the prebuilt library. */
+class BenchLiteralInput {
+public:
+    BenchLiteralInput() {
+        cout << "== Literal contents of " << CELLS << " cells: formula vs parseLiteral" << endl;
+
+        vector<string> contents;
+        mt19937 random(5);
+        while (contents.size() < CELLS)
+            switch (random() % 6) {
+                case 0:
+                    contents.push_back(to_string(random() % 100000));
+                    break;
+                case 1:
+                    contents.push_back(to_string((double) (random() % 1000000) / 100));
+                    break;
+                case 2:
+                    contents.push_back("-" + to_string(random() % 1000) + "." + to_string(random() % 100) + "e" + to_string(random() % 20));
+                    break;
+                case 3:
+                    contents.push_back(to_string(random() % 1000) + " ");
+                    break;
+                case 4:
+                    contents.push_back("Item " + to_string(random() % 1000));
+                    break;
+                default:
+                    contents.push_back(to_string(random() % 100) + "kg");
+            }
+
+        // Both must give the values of parseExpression
+        CStringPool strings;
+        ExpressionBuilder builder;
+        CParser parser;
+        size_t differing = 0;
+        for (const auto &text: contents) {
+            builder.clearExpressions();
+            parseExpression(text, builder);
+            CCellValue expected = builder.formula().literal(), value;
+            parser.parseLiteral(text, strings, value);
+            differing += !(expected.isString() ? value.isString() && value.str() == expected.str()
+                                               : !value.isString() && bit_cast<uint64_t>(value.number()) == bit_cast<uint64_t>(expected.number()));
+        }
+
+        double formulaMs = 0, literalMs = 0, formulaAllocations = 0, literalAllocations = 0;
+        formulaAllocations = countAllocations([&] {
+            formulaMs = measureMs([&] {
+                for (const auto &text: contents) {
+                    parser.parse(text, strings);
+                    CFormula &formula = parser.formula();
+                    formula.fold(strings);
+                    keepValue(formula.literal());
+                }
+            });
+        }, 1);
+        literalAllocations = countAllocations([&] {
+            literalMs = measureMs([&] {
+                for (const auto &text: contents) {
+                    CCellValue value;
+                    parser.parseLiteral(text, strings, value);
+                    keepValue(value);
+                }
+            });
+        }, 1);
+
+        report("classify and convert", "ms", formulaMs, literalMs);
+        report("allocations per cell", "", formulaAllocations / CELLS, literalAllocations / CELLS);
+        reportValue("values differing from parseExpression", "", (double) differing);
+    }
+
+private:
+    static constexpr size_t CELLS = 200000;
+};
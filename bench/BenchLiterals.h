@@ -0,0 +1,77 @@
+#pragma once
+#include "BenchUtils.h"
+#include "../src/CFormula.h"
+#include "../src/CGrid.h"
+#include "../src/CLiteralColumns.h"
+#include <random>
+#include <vector>
+
+using namespace std;
+
+/* Constant cells on 1M cells: numbers stored as one-instruction formulas in the cell grid,
+ * as the sheet did before, compared to the columns of CLiteralColumns, for filling a block
+ * of columns and reading the values of random cells. */
+class BenchLiterals {
+public:
+    BenchLiterals() {
+        cout << "== Constant cells: formulas vs literal columns (" << COLS << " x " << ROWS << " cells)" << endl;
+
+        vector<CPos> lookups;
+        mt19937 random(1);
+        for (int i = 0; i < LOOKUPS; i++)
+            lookups.emplace_back((int) (random() % COLS), (int) (random() % ROWS) + 1);
+
+        CStringPool strings;
+        auto noCells = [](CPos) { return CCellValue(); };
+        double formulaFill, formulaRead, formulaAllocations;
+        {
+            CGrid<CFormula> cells;
+            formulaAllocations = countAllocations([&] {
+                formulaFill = measureMs([&] {
+                    fill([&](CPos pos, double number) {
+                        CFormula formula;
+                        formula.pushNumber(number);
+                        cells[pos] = std::move(formula);
+                    });
+                });
+            }, 1);
+            formulaRead = measureMs([&] {
+                double sum = 0;
+                for (const auto &pos: lookups)
+                    sum += cells.find(pos)->evaluate(noCells, strings).number();
+                keepValue(sum);
+            });
+        }
+
+        double columnFill, columnRead, columnAllocations;
+        {
+            CLiteralColumns cells;
+            columnAllocations = countAllocations([&] {
+                columnFill = measureMs([&] { fill([&](CPos pos, double number) { cells.set(pos, number); }); });
+            }, 1);
+            columnRead = measureMs([&] {
+                double sum = 0;
+                for (const auto &pos: lookups)
+                    sum += cells.find(pos).number();
+                keepValue(sum);
+            });
+        }
+
+        report("fill", "ms", formulaFill, columnFill);
+        report("read (" + to_string(LOOKUPS / 1000000) + "M random cells)", "ms", formulaRead, columnRead);
+        report("allocations per cell", "", formulaAllocations / (COLS * ROWS), columnAllocations / (COLS * ROWS));
+    }
+
+private:
+    static constexpr int COLS = 10;
+    static constexpr int ROWS = 100000;
+    static constexpr int LOOKUPS = 5000000;
+
+    // Store a number into every cell of the block, column by column
+    template <class F>
+    static void fill(F &&set) {
+        for (int col = 0; col < COLS; col++)
+            for (int row = 1; row <= ROWS; row++)
+                set(CPos(col, row), row);
+    }
+};
@@ -0,0 +1,67 @@
+#pragma once
+#include "BenchUtils.h"
+#include "../src/CSpreadsheet.h"
+#include "../src/CThreadPool.h"
+#include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+
+using namespace std;
+
+/* Parallel recalculation of a wide sheet: every column is a chain of formulas reading the
+ * cell above and one shared cell, so each dependency level holds a whole row. One thread
+ * compared to 2, 4 and 8 threads, each sheet keeping its pool across the recalculations.
+ * Also the start and stop of a pool, which every parallel recalculation paid before the
+ * sheet kept it. */
+class BenchParallel {
+public:
+    BenchParallel() {
+        cout << "== Wide sheet of " << COLS << " x " << ROWS << " formulas: recalculate(1) vs recalculate(threads) ("
+             << thread::hardware_concurrency() << " hardware threads)" << endl;
+
+        vector<pair<CPos, string> > cells;
+        cells.reserve((size_t) COLS * ROWS + 1);
+        cells.emplace_back(CPos(0, 1), "1");
+        for (int col = 1; col <= COLS; col++) {
+            string name = columnName(col);
+            cells.emplace_back(CPos(col, 1), to_string(col));
+            for (int row = 2; row <= ROWS; row++)
+                cells.emplace_back(CPos(col, row), "=" + name + to_string(row - 1) + "*$A$1+" + name
+                                                   + to_string(row - 1) + "/3-1");
+        }
+
+        double serialMs = recalculateMs(cells, 1);
+        for (unsigned threads: {2u, 4u, 8u})
+            report("recalculate, " + to_string(threads) + " threads", "ms", serialMs, recalculateMs(cells, threads));
+
+        double poolUs = measureNs([] {
+            CThreadPool pool(8);
+            pool.parallelFor(8, [](size_t) {});
+        }, RECALCULATIONS) / 1e3;
+        reportValue("start and stop of a pool of 8", "us", poolUs);
+    }
+
+private:
+    static constexpr int COLS = 2000;
+    static constexpr int ROWS = 50;
+    static constexpr size_t RECALCULATIONS = 10;
+
+    // Average time of a recalculation after the shared cell changed
+    static double recalculateMs(const vector<pair<CPos, string> > &cells, unsigned threads) {
+        CSpreadsheet sheet;
+        sheet.setCells(cells, threads);
+        double total = 0;
+        for (size_t i = 0; i < RECALCULATIONS; i++) {
+            sheet.setCell(CPos(0, 1), to_string(1.0 + (double) i / RECALCULATIONS));
+            total += measureMs([&] { sheet.recalculate(threads); });
+        }
+        keepValue(sheet.getValue(CPos(COLS, ROWS)));
+        return total / RECALCULATIONS;
+    }
+
+    static string columnName(int col) {
+        char letters[CPos::COLUMN_LETTERS];
+        return string(letters, CPos::columnLetters(col, letters));
+    }
+};
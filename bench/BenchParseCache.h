@@ -0,0 +1,51 @@
+#pragma once
+#include "BenchUtils.h"
+#include "../src/CSpreadsheet.h"
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/* Import of 20000 rows cell by cell, a number and 6 formulas each, with the formulas of a
+ * column equal relative to their row like in a filled-down table: with the formula cache
+ * disabled every formula is parsed, with the default cache only the first row is. */
+class BenchParseCache {
+public:
+    BenchParseCache() {
+        cout << "== Import of " << ROWS << " rows of formulas: no cache vs parse cache" << endl;
+
+        vector<pair<CPos, string> > cells;
+        for (int row = 1; row <= ROWS; row++) {
+            string r = to_string(row);
+            cells.emplace_back(CPos(0, row), to_string(row * 0.5));
+            int col = 1;
+            for (string text: {"=A" + r + "*$H$1", "=B" + r + "+A" + r + "/2-1", "=(C" + r + "-B" + r + ")^2",
+                               "=D" + r + ">=A" + r, "=\"Row \"+A" + r, "=A" + r + "*1.0825+$H$2"})
+                cells.emplace_back(CPos(col++, row), std::move(text));
+        }
+
+        CParseCache::CStats stats;
+        double uncachedMs = import(cells, 0, stats);
+        double cachedMs = import(cells, CParseCache::DEFAULT_LIMIT, stats);
+
+        report("import", "ms", uncachedMs, cachedMs);
+        reportValue("hit rate", "%", stats.hitRate() * 100);
+        reportValue("parsing saved, estimated", "ms", (double) stats.savedNs() / 1e6);
+    }
+
+private:
+    static constexpr int ROWS = 20000;
+
+    static double import(const vector<pair<CPos, string> > &cells, size_t limit, CParseCache::CStats &stats) {
+        CSpreadsheet sheet;
+        sheet.setParseCacheLimit(limit);
+        sheet.setUndoLimit(0);
+        double ms = measureMs([&] {
+            for (const auto &[pos, contents]: cells)
+                sheet.setCell(pos, contents);
+        });
+        keepValue(sheet.getValue(CPos(6, ROWS)));
+        stats = sheet.parseCacheStats();
+        return ms;
+    }
+};
@@ -0,0 +1,74 @@
+#pragma once
+#include "BenchUtils.h"
+#include "../src/CParser.h"
+#include "ExpressionBuilder.h"
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/* Parsing throughput on the contents of 200000 cells (formulas of common shapes, numbers and
+ * text): parseExpression of the prebuilt library driving ExpressionBuilder, compared to
+ * CParser compiling the same CFormula instructions directly. */
+class BenchParser {
+public:
+    BenchParser() {
+        cout << "== Parsing of " << CELLS << " cell contents: parseExpression vs CParser" << endl;
+
+        vector<string> contents;
+        size_t bytes = 0;
+        for (int row = 1; contents.size() < CELLS; row++) {
+            string r = to_string(row);
+            for (string text: {"=A" + r + "*$C$1+B" + r + "/2-(A" + r + ">B" + r + ")", "=B" + r + "*C" + r,
+                               "=(A" + r + "+1)^2>=B" + r + "*C" + r, "=\"Total: \"+A" + r, to_string(row * 1.25),
+                               "Item " + r, "=-A" + r + "^2<>D" + r + "+0.5e1", "=AB" + r + "+$B$2*3.75"}) {
+                bytes += text.size();
+                contents.push_back(std::move(text));
+            }
+        }
+
+        // Both parsers must compile the same instructions
+        CStringPool strings;
+        ExpressionBuilder builder;
+        CParser parser;
+        size_t differing = 0;
+        for (const auto &text: contents) {
+            builder.clearExpressions();
+            parseExpression(text, builder);
+            parser.parse(text, strings);
+            ostringstream library, native;
+            library << builder.formula();
+            native << parser.formula();
+            differing += library.str() != native.str();
+        }
+
+        double libraryMs = 0, nativeMs = 0, libraryAllocations = 0, nativeAllocations = 0;
+        libraryAllocations = countAllocations([&] {
+            libraryMs = measureMs([&] {
+                for (const auto &text: contents) {
+                    builder.clearExpressions();
+                    parseExpression(text, builder);
+                    keepValue(builder.formula());
+                }
+            });
+        }, 1);
+        nativeAllocations = countAllocations([&] {
+            nativeMs = measureMs([&] {
+                for (const auto &text: contents) {
+                    parser.parse(text, strings);
+                    keepValue(parser.formula());
+                }
+            });
+        }, 1);
+
+        report("parse", "ms", libraryMs, nativeMs);
+        reportValue("throughput of parseExpression", "MB/s", (double) bytes / 1e3 / libraryMs);
+        reportValue("throughput of CParser", "MB/s", (double) bytes / 1e3 / nativeMs);
+        report("allocations per cell", "", libraryAllocations / CELLS, nativeAllocations / CELLS);
+        reportValue("cells compiled differently", "", (double) differing);
+    }
+
+private:
+    static constexpr size_t CELLS = 200000;
+};
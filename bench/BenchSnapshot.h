@@ -0,0 +1,56 @@
+#pragma once
+#include "BenchUtils.h"
+#include "../src/CSpreadsheet.h"
+#include <string>
+#include <vector>
+
+using namespace std;
+
+/* Snapshots of a sheet of 200k cells: copying the sheet, then an edit and a read of the
+ * copy. The copies share the tiles of cells, an edit copies only the tile it changes. */
+class BenchSnapshot {
+public:
+    BenchSnapshot() {
+        cout << "== Snapshots of " << COLS << " x " << ROWS << " cells" << endl;
+
+        CSpreadsheet sheet;
+        for (int row = 1; row <= ROWS; row++)
+            for (int col = 0; col < COLS; col++)
+                sheet.setCell(CPos(col, row), col % 2 ? "=" + columnName(col - 1) + to_string(row) + "*2"
+                                                      : to_string(row + col));
+        keepValue(sheet.getValue(CPos(COLS - 1, ROWS)));
+
+        vector<CSpreadsheet> snapshots;
+        snapshots.reserve(SNAPSHOTS);
+        double allocations = 0;
+        double copyMs = measureMs([&] {
+            allocations = countAllocations([&] {
+                for (int i = 0; i < SNAPSHOTS; i++)
+                    snapshots.push_back(sheet);
+            }, 1);
+        });
+        reportValue("copy", "us", copyMs * 1000 / SNAPSHOTS);
+        reportValue("allocations per copy", "", allocations / SNAPSHOTS);
+
+        double editMs = measureMs([&] {
+            for (int i = 0; i < SNAPSHOTS; i++) {
+                snapshots[i].setCell(CPos(0, i + 1), "-1");
+                keepValue(snapshots[i].getValue(CPos(1, i + 1)));
+            }
+        });
+        reportValue("edit and read of a copy", "ms", editMs / SNAPSHOTS);
+
+        double releaseMs = measureMs([&] { snapshots.clear(); });
+        reportValue("release", "ms", releaseMs / SNAPSHOTS);
+    }
+
+private:
+    static constexpr int COLS = 20;
+    static constexpr int ROWS = 10000;
+    static constexpr int SNAPSHOTS = 20;
+
+    static string columnName(int col) {
+        char letters[CPos::COLUMN_LETTERS];
+        return string(letters, CPos::columnLetters(col, letters));
+    }
+};
@@ -0,0 +1,45 @@
+#pragma once
+#include "BenchUtils.h"
+#include "../src/CSpreadsheet.h"
+#include <string>
+
+using namespace std;
+
+/* Undo and redo of a paste of 10 x 10000 cells over cells holding formulas of the same
+ * shape: both restore the recorded contents cell by cell, like the paste stored them. */
+class BenchUndo {
+public:
+    BenchUndo() {
+        cout << "== Undo of a paste of " << COLS << " x " << ROWS << " cells" << endl;
+
+        // Two blocks of rows of formulas, each reading the cell to its left; the second block is pasted over the first one
+        CSpreadsheet sheet;
+        for (int col: {0, COLS + 1}) {
+            sheet.setCell(CPos(col, 1), to_string(col + 1));
+            sheet.setCell(CPos(col + 1, 1), "=" + name(col) + "1*2");
+            sheet.fillRect(CPos(col + 2, 1), CPos(col + 1, 1), COLS - 2, 1);
+            sheet.fillRect(CPos(col, 2), CPos(col, 1), COLS, ROWS - 1, COLS, 1);
+        }
+        sheet.recalculate();
+
+        double pasteMs = measureMs([&] { sheet.copyRect(CPos(0, 1), CPos(COLS + 1, 1), COLS, ROWS); });
+        keepValue(sheet.getValue(CPos(COLS - 1, ROWS)));
+        double undoMs = measureMs([&] { sheet.undo(); });
+        keepValue(sheet.getValue(CPos(COLS - 1, ROWS)));
+        double redoMs = measureMs([&] { sheet.redo(); });
+        keepValue(sheet.getValue(CPos(COLS - 1, ROWS)));
+
+        reportValue("paste", "ms", pasteMs);
+        report("undo (paste / undo)", "ms", pasteMs, undoMs);
+        report("redo (paste / redo)", "ms", pasteMs, redoMs);
+    }
+
+private:
+    static constexpr int COLS = 10;
+    static constexpr int ROWS = 10000;
+
+    static string name(int col) {
+        char letters[CPos::COLUMN_LETTERS];
+        return string(letters, CPos::columnLetters(col, letters));
+    }
+};
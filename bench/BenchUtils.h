@@ -0,0 +1,58 @@
+#pragma once
+#include <atomic>
+#include <chrono>
+#include <cstddef>
+#include <iostream>
+#include <iomanip>
+#include <string>
+
+using namespace std;
+
+// Prevents the optimizer from dropping a computed value
+template <class T>
+inline void keepValue(const T &value) {
+    asm volatile("" : : "g"(&value) : "memory");
+}
+
+// Run f() repeatedly and return the average time of one run in nanoseconds
+template <class F>
+double measureNs(F &&f, size_t repeats) {
+    auto start = chrono::steady_clock::now();
+    for (size_t i = 0; i < repeats; i++)
+        f();
+    auto elapsed = chrono::steady_clock::now() - start;
+    return chrono::duration<double, nano>(elapsed).count() / (double) repeats;
+}
+
+// Number of heap allocations so far, counted by the operator new of BenchAll.cpp; atomic as
+// the worker threads of a CThreadPool allocate too
+inline atomic<size_t> g_Allocations{0};
+
+// Run f() repeatedly and return the average number of heap allocations of one run
+template <class F>
+double countAllocations(F &&f, size_t repeats) {
+    size_t before = g_Allocations.load(memory_order_relaxed);
+    for (size_t i = 0; i < repeats; i++)
+        f();
+    return (double) (g_Allocations.load(memory_order_relaxed) - before) / (double) repeats;
+}
+
+// Run f() once and return the time in milliseconds
+template <class F>
+double measureMs(F &&f) {
+    return measureNs(f, 1) / 1e6;
+}
+
+// Print one result line: name, the measured times and their ratio
+inline void report(const string &name, const string &unit, double baseline, double optimized) {
+    cout << left << setw(36) << name << right << fixed << setprecision(1)
+         << setw(12) << baseline << " " << unit
+         << setw(12) << optimized << " " << unit
+         << setw(8) << setprecision(2) << baseline / optimized << "x" << endl;
+}
+
+// Print one result line of a single measurement
+inline void reportValue(const string &name, const string &unit, double value) {
+    cout << left << setw(36) << name << right << fixed << setprecision(2)
+         << setw(12) << value << " " << unit << endl;
+}
@@ -0,0 +1,62 @@
+#pragma once
+#include "../src/expression.h"
+#include "../src/CFormula.h"
+#include <string>
+#include <vector>
+#include <memory>
+#include <utility>
+using namespace std;
+
+/* Implements the abstract CExprBuilder interface for use with the provided parser.
+ * Collects operands and operators during parsing and compiles them directly into
+ * a CFormula (flat postfix instructions). String literals are interned into the pool
+ * set by setStrings (an own pool by default), which must outlive the formulas. */
+class ExpressionBuilder : public CExprBuilder {
+public:
+    ExpressionBuilder() = default;
+
+    // Arithmetic operators
+    void opAdd() override { m_Formula.pushOperator(EOpcode::Add); }
+    void opSub() override { m_Formula.pushOperator(EOpcode::Sub); }
+    void opMul() override { m_Formula.pushOperator(EOpcode::Mul); }
+    void opDiv() override { m_Formula.pushOperator(EOpcode::Div); }
+    void opPow() override { m_Formula.pushOperator(EOpcode::Pow); }
+    void opNeg() override { m_Formula.pushOperator(EOpcode::Neg); }
+
+    // Comparison operators
+    void opEq() override { m_Formula.pushOperator(EOpcode::Eq); }
+    void opNe() override { m_Formula.pushOperator(EOpcode::Ne); }
+    void opLt() override { m_Formula.pushOperator(EOpcode::Lt); }
+    void opLe() override { m_Formula.pushOperator(EOpcode::Le); }
+    void opGt() override { m_Formula.pushOperator(EOpcode::Gt); }
+    void opGe() override { m_Formula.pushOperator(EOpcode::Ge); }
+
+    // Literal values
+    void valNumber(double val) override { m_Formula.pushNumber(val); }
+    void valString(string val) override { m_Formula.pushString(m_Strings->intern(val)); }
+    void valReference(string val) override { m_Formula.pushReference(CPos(val)); }
+
+    // Hands over the compiled formula and leaves the builder empty
+    CFormula takeFormula() {
+        return std::exchange(m_Formula, CFormula());
+    }
+
+    // Formula compiled so far, the caller may simplify it and keep a placed copy (see CFormula::placed)
+    CFormula &formula() {
+        return m_Formula;
+    }
+
+    // Clears the current formula, its buffer is reused by the next one
+    void clearExpressions() {
+        m_Formula.clear();
+    }
+
+    // Pool receiving the string literals of the following formulas
+    void setStrings(shared_ptr<CStringPool> strings) {
+        m_Strings = std::move(strings);
+    }
+
+private:
+    CFormula m_Formula; // Instructions compiled so far, in postfix order
+    shared_ptr<CStringPool> m_Strings{make_shared<CStringPool>()}; // pool of string literals
+};
@@ -0,0 +1,83 @@
+#pragma once
+#include "../src/expression.h"
+#include "../tests/CExprNodes.h"
+#include <istream>
+#include <map>
+#include <memory>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+// Builds the CExpr nodes the way the sheet stored them before formulas were compiled
+class CNodeBuilder : public CExprBuilder {
+public:
+    void opAdd() override { m_Nodes.push_back(make_unique<CAdd>()); }
+    void opSub() override { m_Nodes.push_back(make_unique<CSub>()); }
+    void opMul() override { m_Nodes.push_back(make_unique<CMul>()); }
+    void opDiv() override { m_Nodes.push_back(make_unique<CDiv>()); }
+    void opPow() override { m_Nodes.push_back(make_unique<CPow>()); }
+    void opNeg() override { m_Nodes.push_back(make_unique<CNeg>()); }
+    void opEq() override { m_Nodes.push_back(make_unique<CEq>()); }
+    void opNe() override { m_Nodes.push_back(make_unique<CNe>()); }
+    void opLt() override { m_Nodes.push_back(make_unique<CLt>()); }
+    void opLe() override { m_Nodes.push_back(make_unique<CLe>()); }
+    void opGt() override { m_Nodes.push_back(make_unique<CGt>()); }
+    void opGe() override { m_Nodes.push_back(make_unique<CGe>()); }
+    void valNumber(double val) override { m_Nodes.push_back(make_unique<CNumber>(val)); }
+    void valString(string val) override { m_Nodes.push_back(make_unique<CString>(val)); }
+    void valReference(string val) override { m_Nodes.push_back(make_unique<CReference>(val)); }
+
+    vector<AExpr> m_Nodes;
+};
+
+/* Read a saved sheet into expression nodes by cell, the way the sheet loaded it before
+ * formulas were compiled: one node per saved token. Returns false if input is invalid. */
+inline bool loadNodes(istream &is, map<CPos, vector<AExpr> > &cells) {
+    string tmp, position;
+    int length, token;
+    while (is >> tmp) {
+        if (tmp != "CPos" || !(is >> position >> tmp) || tmp != "VectorLen" || !(is >> length))
+            return false;
+        vector<AExpr> &nodes = cells[CPos(position)];
+        for (int i = 0; i < length && is >> token; i++) {
+            switch (token) {
+                case 0: nodes.push_back(make_unique<CAdd>()); break;
+                case 1: nodes.push_back(make_unique<CSub>()); break;
+                case 2: nodes.push_back(make_unique<CMul>()); break;
+                case 3: nodes.push_back(make_unique<CDiv>()); break;
+                case 4: nodes.push_back(make_unique<CPow>()); break;
+                case 5: nodes.push_back(make_unique<CNeg>()); break;
+                case 6: nodes.push_back(make_unique<CEq>()); break;
+                case 7: nodes.push_back(make_unique<CNe>()); break;
+                case 8: nodes.push_back(make_unique<CLt>()); break;
+                case 9: nodes.push_back(make_unique<CLe>()); break;
+                case 10: nodes.push_back(make_unique<CGt>()); break;
+                case 11: nodes.push_back(make_unique<CGe>()); break;
+                case 12: {
+                    double number;
+                    is >> number;
+                    nodes.push_back(make_unique<CNumber>(number));
+                    break;
+                }
+                case 13: {
+                    // Read string until met "endOfString"
+                    string result;
+                    while (is >> tmp && tmp != "endOfString")
+                        result += tmp;
+                    nodes.push_back(make_unique<CString>(result));
+                    break;
+                }
+                case 14:
+                    is >> tmp >> position; // "CPos" and the position
+                    nodes.push_back(make_unique<CReference>(position));
+                    break;
+                default:
+                    return false;
+            }
+        }
+        if (is.fail())
+            return false;
+    }
+    return true;
+}
@@ -0,0 +1,39 @@
+#pragma once
+#include <cstddef>
+#include <memory_resource>
+using namespace std;
+
+/* CArena - monotonic memory resource for the compiled formulas of a sheet. Allocations
+ * are bumped from blocks growing geometrically, deallocation does nothing and all blocks
+ * are released at once when the arena is destroyed. Only one sheet allocates from an
+ * arena, under its exclusive lock; copies of the sheet keep it alive while they share
+ * instructions allocated in it. */
+class CArena : public pmr::memory_resource {
+public:
+    CArena() : m_Blocks(INITIAL_BLOCK) {}
+
+    CArena(const CArena &) = delete;
+    CArena &operator =(const CArena &) = delete;
+
+    // Bytes handed out so far, including the ones no longer in use
+    size_t allocated() const { return m_Allocated; }
+
+private:
+    static constexpr size_t INITIAL_BLOCK = 16 * 1024;
+
+    pmr::monotonic_buffer_resource m_Blocks;
+    size_t m_Allocated{0};
+
+    void *do_allocate(size_t bytes, size_t alignment) override {
+        m_Allocated += bytes;
+        return m_Blocks.allocate(bytes, alignment);
+    }
+
+    // Memory is only reclaimed with the whole arena; may be called by any copy of the sheet
+    void do_deallocate(void *, size_t, size_t) override {
+    }
+
+    bool do_is_equal(const pmr::memory_resource &other) const noexcept override {
+        return this == &other;
+    }
+};
@@ -0,0 +1,106 @@
+#pragma once
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <unordered_set>
+#include <variant>
+using namespace std;
+
+// Cell value type: empty, number, or string
+using CValue = variant<monostate, double, string>;
+
+// Format a number for string concatenation: fixed notation without trailing zeros
+inline string numberToString(double val) {
+    string s = to_string(val);
+    // Remove trailing zeros and dot
+    s.erase(s.find_last_not_of('0') + 1, string::npos);
+    if (!s.empty() && s.back() == '.') s.pop_back();
+    return s;
+}
+
+/* CStringPool - interned strings of cached cell values. Every distinct string is stored
+ * once and never moves, so values refer to it by a plain pointer. Strings are not released
+ * one by one; the owner replaces the pool by a new one holding only the strings still in use. */
+class CStringPool {
+public:
+    CStringPool() = default;
+    CStringPool(const CStringPool &) = delete;
+    CStringPool &operator =(const CStringPool &) = delete;
+
+    // Stored copy of the string, equal strings share one copy
+    const string *intern(string_view str) {
+        lock_guard<mutex> lock(m_Mutex);
+        auto it = m_Strings.find(str);
+        if (it == m_Strings.end())
+            it = m_Strings.emplace(str).first;
+        return &*it;
+    }
+
+    size_t size() const {
+        lock_guard<mutex> lock(m_Mutex);
+        return m_Strings.size();
+    }
+
+private:
+    // Hash accepting string_view, so lookups do not construct a string
+    struct CHash {
+        using is_transparent = void;
+        size_t operator ()(string_view str) const { return hash<string_view>()(str); }
+    };
+
+    mutable mutex m_Mutex; // cells of one level are evaluated in parallel
+    unordered_set<string, CHash, equal_to<> > m_Strings;
+};
+
+/* CCellValue - compact cached value of a cell: a type tag and either a number or a pointer
+ * to a string interned in a CStringPool. Trivially copyable, 16 bytes instead of the 40 of
+ * CValue; converts to CValue where values leave the sheet. */
+class CCellValue {
+public:
+    enum class EType : uint8_t { Empty, Number, String };
+
+    CCellValue() = default;
+    CCellValue(double number) : m_Type(EType::Number), m_Number(number) {}
+    CCellValue(const string *str) : m_Type(EType::String), m_String(str) {}
+
+    // Convert a value, interning its string in the pool
+    static CCellValue fromValue(const CValue &value, CStringPool &pool) {
+        if (holds_alternative<double>(value))
+            return get<double>(value);
+        if (holds_alternative<string>(value))
+            return pool.intern(get<string>(value));
+        return {};
+    }
+
+    CValue toValue() const {
+        switch (m_Type) {
+            case EType::Number:
+                return m_Number;
+            case EType::String:
+                return *m_String;
+            default:
+                return {};
+        }
+    }
+
+    EType type() const { return m_Type; }
+    bool empty() const { return m_Type == EType::Empty; }
+    bool isNumber() const { return m_Type == EType::Number; }
+    bool isString() const { return m_Type == EType::String; }
+
+    double number() const { return m_Number; }
+    const string &str() const { return *m_String; }
+
+private:
+    EType m_Type{EType::Empty};
+    union {
+        double m_Number{0};
+        const string *m_String;
+    };
+};
+
+static_assert(sizeof(CCellValue) == 16, "cached values are packed into 16 bytes");
+static_assert(is_trivially_copyable_v<CCellValue>, "cached values are copied as plain bytes");
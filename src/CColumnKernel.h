@@ -0,0 +1,149 @@
+#pragma once
+#include "CFormula.h"
+#include <cstddef>
+#include <cstdint>
+#if defined(__x86_64__)
+#include <immintrin.h>
+#endif
+using namespace std;
+
+/* CColumnKernel - applies one binary operator to whole columns of numbers, e.g. the operands
+ * of a formula copied down a column. Arithmetic and comparisons run on AVX2 (4 numbers at
+ * once) when the processor supports it, otherwise on SSE2 (2 numbers); Pow and the remaining
+ * numbers use applyNumbers. The vector instructions round exactly like the scalar ones,
+ * so every path gives bit for bit the results of the formula evaluation. */
+class CColumnKernel {
+public:
+    enum class EInstructionSet { Scalar, Sse2, Avx2 };
+
+    // Widest instruction set of the processor
+    static EInstructionSet best() {
+#if defined(__x86_64__)
+        static const bool avx2 = __builtin_cpu_supports("avx2");
+        return avx2 ? EInstructionSet::Avx2 : EInstructionSet::Sse2;
+#else
+        return EInstructionSet::Scalar;
+#endif
+    }
+
+    /* out[i] = lhs[i] op rhs[i] for i < count; failed[i] is set where the operator fails
+     * (division by zero) and out[i] is then undefined. */
+    static void apply(EOpcode op, const double *lhs, const double *rhs, double *out, uint8_t *failed, size_t count,
+                      EInstructionSet set = best()) {
+        switch (op) {
+            case EOpcode::Add: applyOp<EOpcode::Add>(lhs, rhs, out, failed, count, set); break;
+            case EOpcode::Sub: applyOp<EOpcode::Sub>(lhs, rhs, out, failed, count, set); break;
+            case EOpcode::Mul: applyOp<EOpcode::Mul>(lhs, rhs, out, failed, count, set); break;
+            case EOpcode::Div: applyOp<EOpcode::Div>(lhs, rhs, out, failed, count, set); break;
+            case EOpcode::Pow: applyOp<EOpcode::Pow>(lhs, rhs, out, failed, count, set); break;
+            case EOpcode::Eq: applyOp<EOpcode::Eq>(lhs, rhs, out, failed, count, set); break;
+            case EOpcode::Ne: applyOp<EOpcode::Ne>(lhs, rhs, out, failed, count, set); break;
+            case EOpcode::Lt: applyOp<EOpcode::Lt>(lhs, rhs, out, failed, count, set); break;
+            case EOpcode::Le: applyOp<EOpcode::Le>(lhs, rhs, out, failed, count, set); break;
+            case EOpcode::Gt: applyOp<EOpcode::Gt>(lhs, rhs, out, failed, count, set); break;
+            case EOpcode::Ge: applyOp<EOpcode::Ge>(lhs, rhs, out, failed, count, set); break;
+            default:
+                for (size_t i = 0; i < count; i++)
+                    failed[i] = true;
+        }
+    }
+
+private:
+    template <EOpcode OP>
+    static void applyOp(const double *lhs, const double *rhs, double *out, uint8_t *failed, size_t count,
+                        EInstructionSet set) {
+        size_t i = 0;
+#if defined(__x86_64__)
+        if (set == EInstructionSet::Avx2)
+            i = applyAvx2<OP>(lhs, rhs, out, failed, count);
+        else if (set == EInstructionSet::Sse2)
+            i = applySse2<OP>(lhs, rhs, out, failed, count);
+#endif
+
+        // Remainder (and the scalar instruction set)
+        for (; i < count; i++)
+            failed[i] = !applyNumbers<OP>(lhs[i], rhs[i], out[i]);
+    }
+
+#if defined(__x86_64__)
+    // Vector loop over 4 numbers at once; returns the number of processed numbers
+    template <EOpcode OP>
+    __attribute__((target("avx2")))
+    static size_t applyAvx2(const double *lhs, const double *rhs, double *out, uint8_t *failed, size_t count) {
+        if constexpr (OP == EOpcode::Pow)
+            return 0;
+        else {
+            const __m256d one = _mm256_set1_pd(1.0);
+            size_t i = 0;
+            for (; i + 4 <= count; i += 4) {
+                __m256d l = _mm256_loadu_pd(lhs + i);
+                __m256d r = _mm256_loadu_pd(rhs + i);
+                __m256d result;
+                int failedMask = 0;
+                if constexpr (OP == EOpcode::Add)
+                    result = _mm256_add_pd(l, r);
+                else if constexpr (OP == EOpcode::Sub)
+                    result = _mm256_sub_pd(l, r);
+                else if constexpr (OP == EOpcode::Mul)
+                    result = _mm256_mul_pd(l, r);
+                else if constexpr (OP == EOpcode::Div) {
+                    failedMask = _mm256_movemask_pd(_mm256_cmp_pd(r, _mm256_setzero_pd(), _CMP_EQ_OQ));
+                    result = _mm256_div_pd(l, r);
+                } else {
+                    // Comparisons: all bits set where true, masked to 1.0; NaN compares like in C++
+                    constexpr int predicate = OP == EOpcode::Eq ? _CMP_EQ_OQ : OP == EOpcode::Ne ? _CMP_NEQ_UQ
+                                            : OP == EOpcode::Lt ? _CMP_LT_OQ : OP == EOpcode::Le ? _CMP_LE_OQ
+                                            : OP == EOpcode::Gt ? _CMP_GT_OQ : _CMP_GE_OQ;
+                    result = _mm256_and_pd(_mm256_cmp_pd(l, r, predicate), one);
+                }
+                _mm256_storeu_pd(out + i, result);
+                for (int k = 0; k < 4; k++)
+                    failed[i + k] = (failedMask >> k) & 1;
+            }
+            return i;
+        }
+    }
+
+    // Vector loop over 2 numbers at once; returns the number of processed numbers
+    template <EOpcode OP>
+    static size_t applySse2(const double *lhs, const double *rhs, double *out, uint8_t *failed, size_t count) {
+        if constexpr (OP == EOpcode::Pow)
+            return 0;
+        else {
+            const __m128d one = _mm_set1_pd(1.0);
+            size_t i = 0;
+            for (; i + 2 <= count; i += 2) {
+                __m128d l = _mm_loadu_pd(lhs + i);
+                __m128d r = _mm_loadu_pd(rhs + i);
+                __m128d result;
+                int failedMask = 0;
+                if constexpr (OP == EOpcode::Add)
+                    result = _mm_add_pd(l, r);
+                else if constexpr (OP == EOpcode::Sub)
+                    result = _mm_sub_pd(l, r);
+                else if constexpr (OP == EOpcode::Mul)
+                    result = _mm_mul_pd(l, r);
+                else if constexpr (OP == EOpcode::Div) {
+                    failedMask = _mm_movemask_pd(_mm_cmpeq_pd(r, _mm_setzero_pd()));
+                    result = _mm_div_pd(l, r);
+                } else if constexpr (OP == EOpcode::Eq)
+                    result = _mm_and_pd(_mm_cmpeq_pd(l, r), one);
+                else if constexpr (OP == EOpcode::Ne)
+                    result = _mm_and_pd(_mm_cmpneq_pd(l, r), one);
+                else if constexpr (OP == EOpcode::Lt)
+                    result = _mm_and_pd(_mm_cmplt_pd(l, r), one);
+                else if constexpr (OP == EOpcode::Le)
+                    result = _mm_and_pd(_mm_cmple_pd(l, r), one);
+                else if constexpr (OP == EOpcode::Gt)
+                    result = _mm_and_pd(_mm_cmpgt_pd(l, r), one);
+                else
+                    result = _mm_and_pd(_mm_cmpge_pd(l, r), one);
+                _mm_storeu_pd(out + i, result);
+                failed[i] = failedMask & 1;
+                failed[i + 1] = (failedMask >> 1) & 1;
+            }
+            return i;
+        }
+    }
+#endif
+};
@@ -0,0 +1,793 @@
+#pragma once
+#include "CCellValue.h"
+#include "CPos.h"
+#include "CShared.h"
+#include <cstdint>
+#include <cmath>
+#include <memory>
+#include <memory_resource>
+#include <string>
+#include <unordered_map>
+#include <vector>
+#include <ostream>
+#include <sstream>
+using namespace std;
+
+/* Opcodes of compiled formulas. The numbers are the tokens save() writes for the
+ * corresponding CExpr nodes, so a formula prints exactly like its expressions. */
+enum class EOpcode : uint8_t {
+    Add = 0, Sub, Mul, Div, Pow, Neg,
+    Eq, Ne, Lt, Le, Gt, Ge,
+    Number, String, Reference
+};
+
+// Apply an operator known at compile time to two numbers; false if it fails
+template <EOpcode OP>
+inline bool applyNumbers(double l, double r, double &result) {
+    if constexpr (OP == EOpcode::Add)
+        result = l + r;
+    else if constexpr (OP == EOpcode::Sub)
+        result = l - r;
+    else if constexpr (OP == EOpcode::Mul)
+        result = l * r;
+    else if constexpr (OP == EOpcode::Div) {
+        if (r == 0)
+            return false;
+        result = l / r;
+    } else if constexpr (OP == EOpcode::Pow)
+        result = pow(l, r);
+    else if constexpr (OP == EOpcode::Eq)
+        result = (double) (l == r);
+    else if constexpr (OP == EOpcode::Ne)
+        result = (double) (l != r);
+    else if constexpr (OP == EOpcode::Lt)
+        result = (double) (l < r);
+    else if constexpr (OP == EOpcode::Le)
+        result = (double) (l <= r);
+    else if constexpr (OP == EOpcode::Gt)
+        result = (double) (l > r);
+    else if constexpr (OP == EOpcode::Ge)
+        result = (double) (l >= r);
+    else
+        return false;
+    return true;
+}
+
+/* CInstruction - one opcode with its operand stored inline:
+ * the number of Number, the interned string of String,
+ * or the packed cell coordinates of Reference: absolute coordinates as they are,
+ * relative ones as the offset from the cell holding the formula (see CFormula::getPos). */
+struct CInstruction {
+    EOpcode m_Op;
+    bool m_AbsCol{false};
+    bool m_AbsRow{false};
+    int32_t m_Col{0};          // Reference column
+    union {
+        double m_Number;       // Number
+        const string *m_String; // String, interned in a CStringPool
+        int32_t m_Row;         // Reference row
+    };
+};
+
+static_assert(sizeof(CInstruction) == 16, "instructions are packed into 16 bytes");
+
+/* CFormula - compiled cell contents: a contiguous array of postfix instructions with
+ * inline operands, evaluated by a switch interpreter instead of one virtual call per
+ * CExpr node. Formulas of the common shape "operand op operand" with references and
+ * numbers (A1+B1, A1*$C$1, A1-1) are recognized while they are built and evaluated by
+ * kernels specialized for the operator and the operand kinds, without the interpreter
+ * loop. The maximum stack depth is computed while the formula is built; a
+ * formula that would pop from an empty stack is invalid and evaluates to an empty value.
+ * String literals are interned in the pool of the sheet and equal interned strings are
+ * compared by address.
+ * The instructions are position independent (relative references are offsets from the
+ * host cell) and shared by all copies of the formula: a formula is a handle to them plus
+ * the position of its host, so copying cells copies handles and moving a formula only
+ * moves the host. The shared instructions are never changed, building a shared formula
+ * copies them first. */
+class CFormula {
+    struct CCode;
+
+public:
+    CFormula() = default;
+
+    // Building (postfix order, as emitted by the parser or read by load)
+    void pushOperator(EOpcode op) {
+        CCode &code = edit();
+        code.m_Instructions.push_back({op});
+        code.m_Depth -= op == EOpcode::Neg ? 0 : 1;
+        if (code.m_Depth < 1)
+            code.m_Valid = false;
+        detectShape(code);
+    }
+
+    void pushNumber(double number) {
+        CInstruction instruction{EOpcode::Number};
+        instruction.m_Number = number;
+        pushOperand(instruction);
+    }
+
+    void pushString(const string *str) {
+        CInstruction instruction{EOpcode::String};
+        instruction.m_String = str;
+        pushOperand(instruction);
+    }
+
+    void pushReference(CPos pos) {
+        CInstruction instruction{EOpcode::Reference, pos.isAbsCol(), pos.isAbsRow()};
+        instruction.m_Col = pos.getCol() - (pos.isAbsCol() ? 0 : m_HostCol);
+        instruction.m_Row = pos.getRow() - (pos.isAbsRow() ? 0 : m_HostRow);
+        pushOperand(instruction);
+    }
+
+    bool empty() const { return code().m_Instructions.empty(); }
+    size_t size() const { return code().m_Instructions.size(); }
+    int maxDepth() const { return code().m_MaxDepth; }
+
+    // True if both formulas run the same instructions, e.g. after copying one to the other
+    bool sharesCode(const CFormula &other) const { return m_Code == other.m_Code; }
+
+    // Formula of a single number or string, such cells are stored as literals (see CLiteralColumns)
+    bool isLiteral() const {
+        const pmr::vector<CInstruction> &instructions = code().m_Instructions;
+        return instructions.size() == 1
+               && (instructions[0].m_Op == EOpcode::Number || instructions[0].m_Op == EOpcode::String);
+    }
+
+    // Value of a literal formula
+    CCellValue literal() const {
+        const CInstruction &instruction = code().m_Instructions[0];
+        return instruction.m_Op == EOpcode::Number ? CCellValue(instruction.m_Number) : CCellValue(instruction.m_String);
+    }
+
+    // Formula of the shape "operand op operand" with references and numbers (see runShape)
+    bool isKernel() const { return code().m_Shape != EShape::Generic; }
+    EOpcode kernelOperator() const { return code().m_Instructions[2].m_Op; }
+    const CInstruction &kernelOperand(size_t i) const { return code().m_Instructions[i]; }
+
+    // Cell referred to by a Reference instruction of the formula
+    CPos getPos(const CInstruction &instruction) const {
+        return {instruction.m_AbsCol ? instruction.m_Col : instruction.m_Col + m_HostCol,
+                instruction.m_AbsRow ? instruction.m_Row : instruction.m_Row + m_HostRow,
+                instruction.m_AbsCol, instruction.m_AbsRow};
+    }
+
+    // Cells referred to by the formula
+    void getReferences(vector<CPos> &references) const {
+        for (const auto &instruction: code().m_Instructions)
+            if (instruction.m_Op == EOpcode::Reference)
+                references.push_back(getPos(instruction));
+    }
+
+    /* Simplify the formula once it is complete, returns the number of removed instructions:
+     * - an operator whose operands are all literals is replaced by the literal it evaluates to,
+     *   unless the evaluation fails or a number would not survive save() and load(),
+     * - x*1, 1*x, x/1, x^1, x-0 and --x become x if x is known to be a number (the result of
+     *   an operator other than +). x+0 is kept, it turns -0 into 0.
+     * The simplified formula evaluates to exactly the same values. New strings go into pool. */
+    size_t fold(CStringPool &pool) {
+        if (!code().m_Valid)
+            return 0;
+
+        vector<CInstruction> code;
+        vector<COperand> operands; // stack of the operands built so far
+        for (const auto &instruction: this->code().m_Instructions) {
+            switch (instruction.m_Op) {
+                case EOpcode::Number:
+                case EOpcode::String:
+                case EOpcode::Reference:
+                    operands.push_back({code.size(), instruction.m_Op == EOpcode::Reference ? EKind::Unknown : EKind::Literal});
+                    code.push_back(instruction);
+                    break;
+                case EOpcode::Neg: {
+                    COperand &operand = operands.back();
+                    if (operand.m_Kind == EKind::Literal && foldLiteral(code, operand.m_Begin, instruction, pool))
+                        break;
+                    if (operand.m_DoubleNeg) {
+                        // -(-x), drop the inner negation
+                        code.pop_back();
+                        operand = {operand.m_Begin, EKind::Number};
+                        break;
+                    }
+                    code.push_back(instruction);
+                    operand.m_DoubleNeg = operand.m_Kind == EKind::Number;
+                    operand.m_Kind = EKind::Number;
+                    break;
+                }
+                default: {
+                    COperand rhs = operands.back();
+                    operands.pop_back();
+                    COperand &lhs = operands.back();
+                    if (lhs.m_Kind == EKind::Literal && rhs.m_Kind == EKind::Literal
+                        && foldLiteral(code, lhs.m_Begin, instruction, pool))
+                        break;
+
+                    // Identity operations on numbers
+                    EOpcode op = instruction.m_Op;
+                    if (lhs.m_Kind == EKind::Number && isNumber(code, rhs, op == EOpcode::Sub ? 0 : 1)
+                        && (op == EOpcode::Mul || op == EOpcode::Div || op == EOpcode::Pow || op == EOpcode::Sub)) {
+                        code.pop_back();
+                        lhs.m_DoubleNeg = false;
+                        break;
+                    }
+                    if (rhs.m_Kind == EKind::Number && isNumber(code, lhs, 1) && op == EOpcode::Mul) {
+                        code.erase(code.begin() + (ptrdiff_t) lhs.m_Begin);
+                        lhs = {lhs.m_Begin, EKind::Number};
+                        break;
+                    }
+
+                    code.push_back(instruction);
+                    bool numbers = (lhs.m_Kind == EKind::Number || isNumber(code, lhs))
+                                   && (rhs.m_Kind == EKind::Number || isNumber(code, rhs));
+                    lhs = {lhs.m_Begin, op != EOpcode::Add || numbers ? EKind::Number : EKind::Unknown};
+                    break;
+                }
+            }
+        }
+
+        size_t removed = size() - code.size();
+        if (!removed)
+            return 0;
+
+        CFormula folded;
+        folded.m_HostCol = m_HostCol;
+        folded.m_HostRow = m_HostRow;
+        for (const auto &instruction: code)
+            folded.pushInstruction(instruction);
+        *this = std::move(folded);
+        return removed;
+    }
+
+    /* Copy of the complete formula whose instructions are allocated in arena, in one block
+     * with their handle. The formula itself keeps its buffer for building the next one. */
+    CFormula placed(pmr::memory_resource &arena) const {
+        CFormula formula;
+        formula.m_HostCol = m_HostCol;
+        formula.m_HostRow = m_HostRow;
+        if (!empty())
+            formula.m_Code = copyCode(arena);
+        return formula;
+    }
+
+    // Remove all instructions, a buffer not shared with other formulas is kept for reuse
+    void clear() {
+        if (m_Code.unique()) {
+            m_Code->m_Instructions.clear();
+            m_Code->m_Depth = m_Code->m_MaxDepth = 0;
+            m_Code->m_Valid = true;
+            m_Code->m_Strings = false;
+            m_Code->m_Shape = EShape::Generic;
+            m_Code->m_MinCol = m_Code->m_MaxCol = m_Code->m_MinRow = m_Code->m_MaxRow = 0;
+        } else
+            m_Code.reset();
+        m_HostCol = m_HostRow = 0;
+    }
+
+    // Copies of instructions moved into a new pool or arena, by their previous instructions
+    class CMoved {
+        friend class CFormula;
+        unordered_map<const CCode *, pair<CCounted<CCode>, CCounted<CCode> > > m_Code; // keeps the previous ones alive
+    };
+
+    /* Move the string literals into another pool. The instructions are copied into arena,
+     * the old ones may be shared with a copy of the sheet still using the old pool; formulas
+     * sharing instructions share the copy recorded in moved. */
+    void internStrings(CStringPool &pool, pmr::memory_resource &arena, CMoved &moved) {
+        if (!m_Code || !m_Code->m_Strings)
+            return;
+
+        auto &[previous, copy] = moved.m_Code[m_Code.get()];
+        if (!copy) {
+            previous = m_Code;
+            copy = copyCode(arena);
+            for (auto &instruction: copy->m_Instructions)
+                if (instruction.m_Op == EOpcode::String)
+                    instruction.m_String = pool.intern(*instruction.m_String);
+        }
+        m_Code = copy;
+    }
+
+    // Copy the instructions into another arena, formulas sharing instructions share the copy recorded in moved
+    void relocate(pmr::memory_resource &arena, CMoved &moved) {
+        if (!m_Code)
+            return;
+
+        auto &[previous, copy] = moved.m_Code[m_Code.get()];
+        if (!copy) {
+            previous = m_Code;
+            copy = copyCode(arena);
+        }
+        m_Code = copy;
+    }
+
+    /* Store the formula in the cell host without changing the cells it refers to:
+     * relative references become offsets from host. Formulas referring to the same
+     * neighbours of their cells then consist of equal instructions. */
+    void anchor(CPos host) {
+        int colOffset = host.getCol() - m_HostCol;
+        int rowOffset = host.getRow() - m_HostRow;
+        if (!colOffset && !rowOffset)
+            return;
+
+        if (!empty()) {
+            CCode &code = edit();
+            code.m_MinCol = code.m_MaxCol = code.m_MinRow = code.m_MaxRow = 0;
+            for (auto &instruction: code.m_Instructions)
+                if (instruction.m_Op == EOpcode::Reference) {
+                    instruction.m_Col -= instruction.m_AbsCol ? 0 : colOffset;
+                    instruction.m_Row -= instruction.m_AbsRow ? 0 : rowOffset;
+                    addReach(code, instruction);
+                }
+        }
+        m_HostCol = host.getCol();
+        m_HostRow = host.getRow();
+    }
+
+    // True if the cell of the formula and every cell it refers to stay in range when moved by an offset
+    bool canMove(int colOffset, int rowOffset) const {
+        if (empty())
+            return true;
+        const CCode &code = this->code();
+        int64_t col = (int64_t) m_HostCol + colOffset, row = (int64_t) m_HostRow + rowOffset;
+        return CPos::inRange(col + code.m_MinCol) && CPos::inRange(col + code.m_MaxCol)
+               && CPos::inRange(row + code.m_MinRow) && CPos::inRange(row + code.m_MaxRow);
+    }
+
+    /* Move relative references by an offset (used when copying cells), the instructions stay
+     * shared. Throws invalid_argument and keeps the formula if a cell would leave the range of
+     * CPos (see canMove) instead of wrapping around. An empty formula has no cell to move. */
+    void changePosition(int colOffset, int rowOffset) {
+        if (empty())
+            return;
+        if (!canMove(colOffset, rowOffset))
+            throw invalid_argument("Position out of range.");
+        m_HostCol += colOffset;
+        m_HostRow += rowOffset;
+    }
+
+    /* Evaluate the formula; readCell(CPos) returns the value of a referred cell
+     * (CValue or CCellValue, whose strings are interned in the pool of the literals).
+     * Semantics follow the CExpr nodes: an empty operand or an unsupported combination
+     * of types makes the whole formula empty. */
+    template <class TReader>
+    CValue evaluate(const TReader &readCell) const {
+        bool text;
+        return run(readCell, text).toValue();
+    }
+
+    // Evaluate into a cached value, a string built by the formula is interned into pool
+    template <class TReader>
+    CCellValue evaluate(const TReader &readCell, CStringPool &pool) const {
+        bool text;
+        CCellValue result = run(readCell, text);
+        return text ? CCellValue(pool.intern(result.str())) : result;
+    }
+
+    // Print in the format of save(), identical to the CExpr nodes the formula was built from
+    friend ostream &operator <<(ostream &os, const CFormula &formula) {
+        for (const auto &instruction: formula.code().m_Instructions) {
+            if (instruction.m_Op == EOpcode::Reference)
+                os << " " << (int) instruction.m_Op << " " << formula.getPos(instruction);
+            else
+                printInstruction(os, instruction);
+        }
+        return os;
+    }
+
+    // Print a literal in the format of save(), as the formula of its single instruction
+    static void printLiteral(ostream &os, const CCellValue &value) {
+        CInstruction instruction{value.isNumber() ? EOpcode::Number : EOpcode::String};
+        if (value.isNumber())
+            instruction.m_Number = value.number();
+        else
+            instruction.m_String = &value.str();
+        printInstruction(os, instruction);
+    }
+
+private:
+    /* CSlot - value on the evaluation stack. Strings point into the pool, or to the own
+     * buffer (text) if they are built during evaluation or come from a CValue. */
+    struct CSlot {
+        CCellValue m_Value;
+        string m_Text;
+
+        bool isText() const { return m_Value.isString() && &m_Value.str() == &m_Text; }
+    };
+
+    /* CStack - evaluation stack reused by all evaluations on the calling thread. The slots
+     * never move during an evaluation and keep their text buffers between evaluations,
+     * so numbers, literals and references are pushed without allocating. */
+    class CStack {
+    public:
+        // Empty the stack and make sure depth values fit without growing
+        void reset(size_t depth) {
+            m_Size = 0;
+            if (m_Slots.size() < depth)
+                m_Slots.resize(depth);
+        }
+
+        CSlot &push() { return m_Slots[m_Size++]; }
+        CSlot &top() { return m_Slots[m_Size - 1]; }
+        CSlot &second() { return m_Slots[m_Size - 2]; }
+        void pop() { m_Size--; }
+
+        // Push the value of a referred cell; returns false (and pushes nothing) if it is empty
+        bool pushCell(const CCellValue &value) {
+            if (value.empty())
+                return false;
+            push().m_Value = value;
+            return true;
+        }
+
+        bool pushCell(const CValue &value) {
+            if (holds_alternative<double>(value))
+                push().m_Value = get<double>(value);
+            else if (holds_alternative<string>(value)) {
+                CSlot &slot = push();
+                slot.m_Text = get<string>(value);
+                slot.m_Value = &slot.m_Text;
+            } else
+                return false;
+            return true;
+        }
+
+        static CStack &local() {
+            static thread_local CStack stack;
+            return stack;
+        }
+
+    private:
+        vector<CSlot> m_Slots;
+        size_t m_Size{0};
+    };
+
+    // What is known about an operand while folding
+    enum class EKind : uint8_t {
+        Literal,                 // a single Number or String instruction
+        Number,                  // evaluates to a number or fails
+        Unknown                  // may be a string (reference, + of unknown operands)
+    };
+
+    // Operand of the formula being folded: its instructions start at m_Begin
+    struct COperand {
+        size_t m_Begin;
+        EKind m_Kind;
+        bool m_DoubleNeg{false}; // negation of a number, another negation cancels it
+    };
+
+    // Shapes of formulas evaluated by a specialized kernel (see runShape)
+    enum class EShape : uint8_t {
+        Generic,                 // any other formula, run by the interpreter loop
+        RefRef,                  // A1 op B1
+        RefNum,                  // A1 op 2
+        NumRef                   // 2 op A1
+    };
+
+    // Instructions of a formula together with what is known about them
+    struct CCode {
+        pmr::vector<CInstruction> m_Instructions; // postfix instructions, copies go to the heap
+        int m_Depth{0};              // stack depth after the last instruction
+        int m_MaxDepth{0};           // maximum stack depth during evaluation
+        bool m_Valid{true};          // false if an operator lacks operands
+        bool m_Strings{false};       // true if there are string literals
+        EShape m_Shape{EShape::Generic};
+        int32_t m_MinCol{0};         // bounds of the offsets of the relative references and 0, the
+        int32_t m_MaxCol{0};         // cells a moved formula refers to lie between them (see canMove)
+        int32_t m_MinRow{0};
+        int32_t m_MaxRow{0};
+
+        CCode() = default;
+        CCode(const CCode &src) = default;
+
+        // Copy whose instructions are allocated by resource
+        CCode(const CCode &src, pmr::memory_resource *resource)
+            : m_Instructions(src.m_Instructions, resource), m_Depth(src.m_Depth), m_MaxDepth(src.m_MaxDepth),
+              m_Valid(src.m_Valid), m_Strings(src.m_Strings), m_Shape(src.m_Shape), m_MinCol(src.m_MinCol),
+              m_MaxCol(src.m_MaxCol), m_MinRow(src.m_MinRow), m_MaxRow(src.m_MaxRow) {
+        }
+    };
+
+    CCounted<CCode> m_Code;      // shared by copies, never changed once shared; null if empty
+    int32_t m_HostCol{0};        // cell holding the formula, relative references are offsets from it
+    int32_t m_HostRow{0};
+
+    // Print an instruction other than a reference in the format of save()
+    static void printInstruction(ostream &os, const CInstruction &instruction) {
+        os << " " << (int) instruction.m_Op << " ";
+        if (instruction.m_Op == EOpcode::Number)
+            os << instruction.m_Number << " ";
+        else if (instruction.m_Op == EOpcode::String)
+            os << *instruction.m_String << " endOfString ";
+    }
+
+    const CCode &code() const {
+        static const CCode empty;
+        return m_Code ? *m_Code : empty;
+    }
+
+    // Instructions to be changed, copied first if they are shared
+    CCode &edit() {
+        if (!m_Code)
+            m_Code = CCounted<CCode>::make();
+        else if (!m_Code.unique())
+            m_Code = CCounted<CCode>::make(*m_Code);
+        return *m_Code;
+    }
+
+    // Copy of the instructions allocated in arena together with their control block
+    CCounted<CCode> copyCode(pmr::memory_resource &arena) const {
+        return CCounted<CCode>::allocate(pmr::polymorphic_allocator<CCode>(&arena), *m_Code, &arena);
+    }
+
+    void pushOperand(const CInstruction &instruction) {
+        CCode &code = edit();
+        code.m_Instructions.push_back(instruction);
+        code.m_MaxDepth = max(code.m_MaxDepth, ++code.m_Depth);
+        code.m_Strings |= instruction.m_Op == EOpcode::String;
+        addReach(code, instruction);
+        detectShape(code);
+    }
+
+    // Widen the bounds of the relative offsets by a reference
+    static void addReach(CCode &code, const CInstruction &instruction) {
+        if (instruction.m_Op != EOpcode::Reference)
+            return;
+        if (!instruction.m_AbsCol) {
+            code.m_MinCol = min(code.m_MinCol, instruction.m_Col);
+            code.m_MaxCol = max(code.m_MaxCol, instruction.m_Col);
+        }
+        if (!instruction.m_AbsRow) {
+            code.m_MinRow = min(code.m_MinRow, instruction.m_Row);
+            code.m_MaxRow = max(code.m_MaxRow, instruction.m_Row);
+        }
+    }
+
+    void pushInstruction(const CInstruction &instruction) {
+        if (instruction.m_Op >= EOpcode::Number)
+            pushOperand(instruction);
+        else
+            pushOperator(instruction.m_Op);
+    }
+
+    // Operand is the number literal value
+    static bool isNumber(const vector<CInstruction> &code, const COperand &operand, double value) {
+        if (!isNumber(code, operand))
+            return false;
+        double number = code[operand.m_Begin].m_Number;
+        return number == value && signbit(number) == signbit(value);
+    }
+
+    static bool isNumber(const vector<CInstruction> &code, const COperand &operand) {
+        return operand.m_Kind == EKind::Literal && code[operand.m_Begin].m_Op == EOpcode::Number;
+    }
+
+    /* Replace the literal operands from begin on and the operator applied to them by the
+     * resulting literal; returns false and changes nothing if the operator would fail. */
+    static bool foldLiteral(vector<CInstruction> &code, size_t begin, CInstruction op, CStringPool &pool) {
+        CFormula constant;
+        for (size_t i = begin; i < code.size(); i++)
+            constant.pushInstruction(code[i]);
+        constant.pushInstruction(op);
+        CCellValue value = constant.evaluate([](CPos) { return CCellValue(); }, pool);
+
+        CInstruction literal{EOpcode::Number};
+        if (value.isNumber() && savesExactly(value.number()))
+            literal.m_Number = value.number();
+        else if (value.isString()) {
+            literal.m_Op = EOpcode::String;
+            literal.m_String = &value.str();
+        } else
+            return false;
+
+        code.resize(begin);
+        code.push_back(literal);
+        return true;
+    }
+
+    // A number that is printed by save() and read back by load() unchanged
+    static bool savesExactly(double number) {
+        ostringstream os;
+        os << number;
+        istringstream is(os.str());
+        double loaded;
+        return is >> loaded && loaded == number && signbit(loaded) == signbit(number);
+    }
+
+    // Recognize the shape of the instructions built so far
+    static void detectShape(CCode &code) {
+        const pmr::vector<CInstruction> &instructions = code.m_Instructions;
+        code.m_Shape = EShape::Generic;
+        if (instructions.size() != 3 || !code.m_Valid || instructions[2].m_Op >= EOpcode::Neg)
+            return;
+
+        EOpcode lhs = instructions[0].m_Op;
+        EOpcode rhs = instructions[1].m_Op;
+        if (lhs == EOpcode::Reference && rhs == EOpcode::Reference)
+            code.m_Shape = EShape::RefRef;
+        else if (lhs == EOpcode::Reference && rhs == EOpcode::Number)
+            code.m_Shape = EShape::RefNum;
+        else if (lhs == EOpcode::Number && rhs == EOpcode::Reference)
+            code.m_Shape = EShape::NumRef;
+    }
+
+    /* Evaluate the formula. A string result may be text built during the evaluation
+     * (text is set), it stays valid until the next evaluation on the calling thread. */
+    template <class TReader>
+    CCellValue run(const TReader &readCell, bool &text) const {
+        text = false;
+        switch (code().m_Shape) {
+            case EShape::RefRef: return runShape<true, true>(readCell, text);
+            case EShape::RefNum: return runShape<true, false>(readCell, text);
+            case EShape::NumRef: return runShape<false, true>(readCell, text);
+            default: return runInstructions(readCell, text);
+        }
+    }
+
+    // Run the instructions by the interpreter loop
+    template <class TReader>
+    CCellValue runInstructions(const TReader &readCell, bool &text) const {
+        const CCode &code = this->code();
+        if (!code.m_Valid || code.m_Instructions.empty())
+            return {};
+
+        CStack &values = CStack::local();
+        values.reset(code.m_MaxDepth);
+
+        for (const auto &instruction: code.m_Instructions) {
+            switch (instruction.m_Op) {
+                case EOpcode::Number:
+                    values.push().m_Value = instruction.m_Number;
+                    break;
+                case EOpcode::String:
+                    values.push().m_Value = instruction.m_String;
+                    break;
+                case EOpcode::Reference:
+                    if (!values.pushCell(readCell(getPos(instruction))))
+                        return {};
+                    break;
+                case EOpcode::Neg: {
+                    CCellValue &operand = values.top().m_Value;
+                    if (!operand.isNumber())
+                        return {};
+                    operand = -operand.number();
+                    break;
+                }
+                default:
+                    // Binary operator: the result replaces the left operand
+                    if (!applyBinary(instruction.m_Op, values.second(), values.top()))
+                        return {};
+                    values.pop();
+                    break;
+            }
+        }
+
+        text = values.top().isText();
+        return values.top().m_Value;
+    }
+
+    // Select the kernel of a "operand op operand" formula by its operator
+    template <bool LHS_REF, bool RHS_REF, class TReader>
+    CCellValue runShape(const TReader &readCell, bool &text) const {
+        switch (m_Code->m_Instructions[2].m_Op) {
+            case EOpcode::Add: return runKernel<EOpcode::Add, LHS_REF, RHS_REF>(readCell, text);
+            case EOpcode::Sub: return runKernel<EOpcode::Sub, LHS_REF, RHS_REF>(readCell, text);
+            case EOpcode::Mul: return runKernel<EOpcode::Mul, LHS_REF, RHS_REF>(readCell, text);
+            case EOpcode::Div: return runKernel<EOpcode::Div, LHS_REF, RHS_REF>(readCell, text);
+            case EOpcode::Pow: return runKernel<EOpcode::Pow, LHS_REF, RHS_REF>(readCell, text);
+            case EOpcode::Eq: return runKernel<EOpcode::Eq, LHS_REF, RHS_REF>(readCell, text);
+            case EOpcode::Ne: return runKernel<EOpcode::Ne, LHS_REF, RHS_REF>(readCell, text);
+            case EOpcode::Lt: return runKernel<EOpcode::Lt, LHS_REF, RHS_REF>(readCell, text);
+            case EOpcode::Le: return runKernel<EOpcode::Le, LHS_REF, RHS_REF>(readCell, text);
+            case EOpcode::Gt: return runKernel<EOpcode::Gt, LHS_REF, RHS_REF>(readCell, text);
+            default: return runKernel<EOpcode::Ge, LHS_REF, RHS_REF>(readCell, text);
+        }
+    }
+
+    /* Fused evaluation of "operand op operand": two numbers are combined by the operator
+     * known at compile time, without the stack. Other operands (strings, empty cells)
+     * are left to the interpreter loop. */
+    template <EOpcode OP, bool LHS_REF, bool RHS_REF, class TReader>
+    CCellValue runKernel(const TReader &readCell, bool &text) const {
+        const pmr::vector<CInstruction> &instructions = m_Code->m_Instructions;
+        double l, r;
+        if (!loadNumber<LHS_REF>(instructions[0], readCell, l) || !loadNumber<RHS_REF>(instructions[1], readCell, r))
+            return runInstructions(readCell, text);
+
+        double result;
+        if (!applyNumbers<OP>(l, r, result))
+            return {};
+        return result;
+    }
+
+    // Load a reference (REF) or a number operand; false if it is not a number
+    template <bool REF, class TReader>
+    bool loadNumber(const CInstruction &instruction, const TReader &readCell, double &number) const {
+        if constexpr (REF)
+            return toNumber(readCell(getPos(instruction)), number);
+        else {
+            number = instruction.m_Number;
+            return true;
+        }
+    }
+
+    static bool toNumber(const CCellValue &value, double &number) {
+        if (!value.isNumber())
+            return false;
+        number = value.number();
+        return true;
+    }
+
+    static bool toNumber(const CValue &value, double &number) {
+        if (!holds_alternative<double>(value))
+            return false;
+        number = get<double>(value);
+        return true;
+    }
+
+    // Apply a binary operator to two non-empty values, storing the result into lhs
+    static bool applyBinary(EOpcode op, CSlot &lhs, const CSlot &rhs) {
+        const CCellValue &left = lhs.m_Value;
+        const CCellValue &right = rhs.m_Value;
+
+        if (left.isNumber() && right.isNumber()) {
+            double l = left.number();
+            double r = right.number();
+            double result;
+            bool success;
+            switch (op) {
+                case EOpcode::Add: success = applyNumbers<EOpcode::Add>(l, r, result); break;
+                case EOpcode::Sub: success = applyNumbers<EOpcode::Sub>(l, r, result); break;
+                case EOpcode::Mul: success = applyNumbers<EOpcode::Mul>(l, r, result); break;
+                case EOpcode::Div: success = applyNumbers<EOpcode::Div>(l, r, result); break;
+                case EOpcode::Pow: success = applyNumbers<EOpcode::Pow>(l, r, result); break;
+                case EOpcode::Eq: success = applyNumbers<EOpcode::Eq>(l, r, result); break;
+                case EOpcode::Ne: success = applyNumbers<EOpcode::Ne>(l, r, result); break;
+                case EOpcode::Lt: success = applyNumbers<EOpcode::Lt>(l, r, result); break;
+                case EOpcode::Le: success = applyNumbers<EOpcode::Le>(l, r, result); break;
+                case EOpcode::Gt: success = applyNumbers<EOpcode::Gt>(l, r, result); break;
+                case EOpcode::Ge: success = applyNumbers<EOpcode::Ge>(l, r, result); break;
+                default: return false;
+            }
+            if (success)
+                lhs.m_Value = result;
+            return success;
+        }
+
+        // Concatenation of a string with a string or a number, built in the text of lhs
+        if (op == EOpcode::Add) {
+            if (!lhs.isText()) {
+                if (left.isNumber())
+                    lhs.m_Text = numberToString(left.number());
+                else
+                    lhs.m_Text.assign(left.str());
+                lhs.m_Value = &lhs.m_Text;
+            }
+            if (right.isNumber())
+                lhs.m_Text += numberToString(right.number());
+            else
+                lhs.m_Text += right.str();
+            return true;
+        }
+
+        // Comparison of two strings; interned strings are equal only if they are the same one
+        if (!left.isString() || !right.isString())
+            return false;
+        bool interned = !lhs.isText() && !rhs.isText();
+        if (interned && (op == EOpcode::Eq || op == EOpcode::Ne)) {
+            bool equal = &left.str() == &right.str();
+            lhs.m_Value = (double) (op == EOpcode::Eq ? equal : !equal);
+            return true;
+        }
+
+        int order = left.str().compare(right.str());
+        switch (op) {
+            case EOpcode::Eq: lhs.m_Value = (double) (order == 0); return true;
+            case EOpcode::Ne: lhs.m_Value = (double) (order != 0); return true;
+            case EOpcode::Lt: lhs.m_Value = (double) (order < 0); return true;
+            case EOpcode::Le: lhs.m_Value = (double) (order <= 0); return true;
+            case EOpcode::Gt: lhs.m_Value = (double) (order > 0); return true;
+            case EOpcode::Ge: lhs.m_Value = (double) (order >= 0); return true;
+            default: return false;
+        }
+    }
+};
@@ -0,0 +1,222 @@
+#pragma once
+#include "CPos.h"
+#include "CShared.h"
+#include <algorithm>
+#include <array>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+using namespace std;
+
+/* CGrid - sparse storage of values by cell position, in square tiles of TILE x TILE cells.
+ * Tiles are found through a hash index in O(1). A tile maps each of its positions to a
+ * slot by a dense array, and keeps the slots in chunks allocated as the tile fills, so
+ * neighbouring cells share a tile and mostly a chunk. Slots never move: a reference to a
+ * value stays valid until the value is erased. Regions without values cost nothing, a
+ * tile in use costs two bytes per position on top of its slots.
+ * A copy of the grid shares the index and the tiles (see CShared) and is taken in O(1).
+ * Non-const access copies the index and the tile it reaches first if they are still
+ * shared, so a change to either grid copies only the tiles it touches. References into a
+ * tile are valid in the grid they were obtained from until the grid is copied again. */
+template <class T>
+class CGrid {
+public:
+    static constexpr int TILE_BITS = 6;
+    static constexpr int TILE = 1 << TILE_BITS; // tile edge in cells
+
+    CGrid() = default;
+
+    CGrid(const CGrid &src) = default;
+    CGrid &operator =(const CGrid &src) = default;
+
+    CGrid(CGrid &&src) noexcept : m_Tiles(src.m_Tiles), m_Size(std::exchange(src.m_Size, 0)) {
+        src.m_Tiles = CShared<CIndex>();
+    }
+
+    CGrid &operator =(CGrid &&src) noexcept {
+        m_Tiles = src.m_Tiles;
+        m_Size = std::exchange(src.m_Size, 0);
+        src.m_Tiles = CShared<CIndex>();
+        return *this;
+    }
+
+    size_t size() const { return m_Size; }
+    bool empty() const { return m_Size == 0; }
+
+    // Value at pos to be changed, nullptr if there is none
+    T *find(CPos pos) {
+        CIndex &index = m_Tiles.edit();
+        auto it = index.find(tileKey(pos));
+        if (it == index.end())
+            return nullptr;
+        uint16_t slot = it->second->m_Slots[offset(pos)];
+        return slot ? &it->second.edit().slot(slot - 1) : nullptr;
+    }
+
+    const T *find(CPos pos) const {
+        auto it = m_Tiles->find(tileKey(pos));
+        if (it == m_Tiles->end())
+            return nullptr;
+        const CTile &tile = *it->second;
+        uint16_t slot = tile.m_Slots[offset(pos)];
+        return slot ? &tile.slot(slot - 1) : nullptr;
+    }
+
+    // Value at pos, a default constructed one is inserted if there is none
+    T &operator [](CPos pos) {
+        CTile &tile = m_Tiles.edit()[tileKey(pos)].edit(); // a new tile if there was none
+
+        uint16_t &slot = tile.m_Slots[offset(pos)];
+        if (!slot) {
+            slot = tile.allocate() + 1;
+            tile.m_Columns[pos.getCol() & (TILE - 1)]++;
+            m_Size++;
+        }
+        return tile.slot(slot - 1);
+    }
+
+    // Remove the value at pos; returns false if there is none
+    bool erase(CPos pos) {
+        CIndex &index = m_Tiles.edit();
+        auto it = index.find(tileKey(pos));
+        if (it == index.end() || !it->second->m_Slots[offset(pos)])
+            return false;
+
+        CTile &tile = it->second.edit();
+        uint16_t &slot = tile.m_Slots[offset(pos)];
+        tile.release(slot - 1);
+        tile.m_Columns[pos.getCol() & (TILE - 1)]--;
+        slot = 0;
+        m_Size--;
+        if (!tile.m_Size)
+            index.erase(it);
+        return true;
+    }
+
+    void clear() {
+        m_Tiles = CShared<CIndex>();
+        m_Size = 0;
+    }
+
+    /* Call f(pos, value) for every value: tile by tile, ordered by the column and then the row
+     * of the tiles, and column by column within a tile. The order does not depend on the order
+     * of insertion. */
+    template <class F>
+    void forEach(F &&f) {
+        for (const auto &[key, tile]: sortedTiles())
+            m_Tiles.edit()[key].edit().forEach(key, f);
+    }
+
+    template <class F>
+    void forEach(F &&f) const {
+        for (const auto &[key, tile]: sortedTiles())
+            tile->forEach(key, f);
+    }
+
+    // Number of tiles in use, each covering TILE x TILE positions
+    size_t tiles() const { return m_Tiles->size(); }
+
+    // Number of tiles shared with other grids, e.g. a copy not changed there since
+    size_t sharedTiles(const CGrid &other) const {
+        size_t shared = 0;
+        for (const auto &[key, tile]: *m_Tiles) {
+            auto it = other.m_Tiles->find(key);
+            shared += it != other.m_Tiles->end() && it->second.shares(tile);
+        }
+        return shared;
+    }
+
+private:
+    static constexpr size_t CHUNK = 64; // slots allocated at once
+
+    // One tile: slot + 1 of each position (0 if it has no value) and the slots
+    struct CTile {
+        array<uint16_t, TILE * TILE> m_Slots{}; // column by column
+        array<uint8_t, TILE> m_Columns{};       // positions holding a value in each column
+        vector<unique_ptr<T[]> > m_Chunks;
+        vector<uint16_t> m_Free;                // released slots, reused first
+        uint16_t m_Allocated{0};                // slots handed out, including released ones
+        uint16_t m_Size{0};                     // positions holding a value
+
+        CTile() = default;
+
+        CTile(const CTile &src) : m_Slots(src.m_Slots), m_Columns(src.m_Columns), m_Free(src.m_Free),
+                                  m_Allocated(src.m_Allocated), m_Size(src.m_Size) {
+            for (const auto &chunk: src.m_Chunks) {
+                m_Chunks.push_back(make_unique<T[]>(CHUNK));
+                copy(chunk.get(), chunk.get() + CHUNK, m_Chunks.back().get());
+            }
+        }
+
+        T &slot(uint16_t index) { return m_Chunks[index / CHUNK][index % CHUNK]; }
+        const T &slot(uint16_t index) const { return m_Chunks[index / CHUNK][index % CHUNK]; }
+
+        uint16_t allocate() {
+            m_Size++;
+            if (!m_Free.empty()) {
+                uint16_t index = m_Free.back();
+                m_Free.pop_back();
+                return index;
+            }
+            if (m_Allocated == m_Chunks.size() * CHUNK)
+                m_Chunks.push_back(make_unique<T[]>(CHUNK));
+            return m_Allocated++;
+        }
+
+        // Reset the value of a slot, so it releases its resources, and keep the slot for reuse
+        void release(uint16_t index) {
+            slot(index) = T();
+            m_Free.push_back(index);
+            m_Size--;
+        }
+
+        template <class TTile, class F>
+        static void forEach(TTile &tile, uint64_t key, F &f) {
+            int col = (int) (int32_t) (key >> 32) * TILE;
+            int row = (int) (int32_t) (uint32_t) key * TILE;
+            for (int column = 0; column < TILE; column++) {
+                if (!tile.m_Columns[column])
+                    continue; // skip empty columns of the tile
+                const uint16_t *slots = tile.m_Slots.data() + column * TILE;
+                for (int i = 0; i < TILE; i++)
+                    if (slots[i])
+                        f(CPos(col + column, row + i), tile.slot(slots[i] - 1));
+            }
+        }
+
+        template <class F>
+        void forEach(uint64_t key, F &f) { forEach(*this, key, f); }
+
+        template <class F>
+        void forEach(uint64_t key, F &f) const { forEach(*this, key, f); }
+    };
+
+    using CIndex = unordered_map<uint64_t, CShared<CTile> >;
+
+    CShared<CIndex> m_Tiles; // tiles by tileKey
+    size_t m_Size{0};
+
+    // Column and row of the tile holding pos, packed (tiles of negative positions included)
+    static uint64_t tileKey(CPos pos) {
+        return (uint64_t) (uint32_t) (pos.getCol() >> TILE_BITS) << 32 | (uint32_t) (pos.getRow() >> TILE_BITS);
+    }
+
+    // Index of pos within its tile
+    static size_t offset(CPos pos) {
+        return (size_t) (pos.getCol() & (TILE - 1)) * TILE + (size_t) (pos.getRow() & (TILE - 1));
+    }
+
+    // Tiles ordered by their column and row
+    vector<pair<uint64_t, const CTile *> > sortedTiles() const {
+        vector<pair<uint64_t, const CTile *> > tiles;
+        for (const auto &[key, tile]: *m_Tiles)
+            tiles.emplace_back(key, &*tile);
+        sort(tiles.begin(), tiles.end(), [](const auto &a, const auto &b) {
+            return make_pair((int32_t) (a.first >> 32), (int32_t) (uint32_t) a.first)
+                   < make_pair((int32_t) (b.first >> 32), (int32_t) (uint32_t) b.first);
+        });
+        return tiles;
+    }
+};
@@ -0,0 +1,129 @@
+#pragma once
+#include "CPos.h"
+#include "CCellValue.h"
+#include "CFormula.h"
+#include <cstddef>
+#include <deque>
+#include <memory_resource>
+#include <utility>
+#include <vector>
+using namespace std;
+
+/* CJournal - undo and redo history of a sheet. An edit is recorded as the contents its
+ * cells had before it: a literal, or a formula handle sharing its instructions with the
+ * cells, so a recorded formula costs no copy. Undoing an edit restores these contents
+ * and records the replaced ones as the edit to redo. The history is bounded by a number
+ * of bytes of records, counting the instructions of every recorded formula since a record
+ * may be the last to keep them alive; the oldest edits are forgotten first. */
+class CJournal {
+public:
+    static constexpr size_t DEFAULT_LIMIT = 64 << 20;
+
+    // Previous contents of one cell: a literal, or the formula if there is none (both empty for an empty cell)
+    struct CChange {
+        CPos m_Pos;
+        CCellValue m_Literal;
+        CFormula m_Formula;
+    };
+
+    using CEdit = vector<CChange>;
+
+    explicit CJournal(size_t limit = DEFAULT_LIMIT) : m_Limit(limit) {}
+
+    // Bound of the bytes of all records, 0 keeps no history
+    size_t limit() const { return m_Limit; }
+
+    void setLimit(size_t limit) {
+        m_Limit = limit;
+        trim();
+    }
+
+    // Bytes of all records
+    size_t bytes() const { return m_Bytes; }
+
+    bool empty() const { return m_Undo.empty() && m_Redo.empty(); }
+    bool canUndo() const { return !m_Undo.empty(); }
+    bool canRedo() const { return !m_Redo.empty(); }
+
+    // Record a new edit; the edits undone before can no longer be redone
+    void record(CEdit edit) {
+        while (!m_Redo.empty())
+            drop(m_Redo);
+        push(m_Undo, std::move(edit));
+    }
+
+    // Take the last edit to undo, or the last undone edit to redo
+    CEdit takeUndo() { return take(m_Undo); }
+    CEdit takeRedo() { return take(m_Redo); }
+
+    // Record the contents replaced by undoing an edit (to redo it) or by redoing it (to undo it again)
+    void undone(CEdit edit) { push(m_Redo, std::move(edit)); }
+    void redone(CEdit edit) { push(m_Undo, std::move(edit)); }
+
+    void clear() {
+        m_Undo.clear();
+        m_Redo.clear();
+        m_Bytes = 0;
+    }
+
+    // Move the strings of the records into another pool (see CFormula::internStrings)
+    void internStrings(CStringPool &pool, pmr::memory_resource &arena, CFormula::CMoved &moved) {
+        forEach([&pool, &arena, &moved](CChange &change) {
+            change.m_Formula.internStrings(pool, arena, moved);
+            if (change.m_Literal.isString())
+                change.m_Literal = pool.intern(change.m_Literal.str());
+        });
+    }
+
+    // Move the instructions of the recorded formulas into another arena (see CFormula::relocate)
+    void relocate(pmr::memory_resource &arena, CFormula::CMoved &moved) {
+        forEach([&arena, &moved](CChange &change) { change.m_Formula.relocate(arena, moved); });
+    }
+
+private:
+    size_t m_Limit;
+    size_t m_Bytes{0};
+    deque<CEdit> m_Undo; // oldest first
+    deque<CEdit> m_Redo; // the edit undone first is the oldest
+
+    static size_t bytes(const CEdit &edit) {
+        size_t bytes = sizeof(CEdit) + edit.capacity() * sizeof(CChange);
+        for (const auto &change: edit)
+            bytes += change.m_Formula.size() * sizeof(CInstruction);
+        return bytes;
+    }
+
+    void push(deque<CEdit> &edits, CEdit edit) {
+        m_Bytes += bytes(edit);
+        edits.push_back(std::move(edit));
+        trim();
+    }
+
+    CEdit take(deque<CEdit> &edits) {
+        CEdit edit = std::move(edits.back());
+        edits.pop_back();
+        m_Bytes -= bytes(edit);
+        return edit;
+    }
+
+    void drop(deque<CEdit> &edits) {
+        m_Bytes -= bytes(edits.front());
+        edits.pop_front();
+    }
+
+    // Forget the oldest edits to undo, then the edits to redo undone first, until within the limit
+    void trim() {
+        while (m_Bytes > m_Limit && !m_Undo.empty())
+            drop(m_Undo);
+        while (m_Bytes > m_Limit && !m_Redo.empty())
+            drop(m_Redo);
+    }
+
+    template <class F>
+    void forEach(F &&f) {
+        for (auto *edits: {&m_Undo, &m_Redo})
+            for (auto &edit: *edits)
+                for (auto &change: edit)
+                    f(change);
+    }
+};
@@ -0,0 +1,196 @@
+#pragma once
+#include "CPos.h"
+#include "CCellValue.h"
+#include "CShared.h"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cstdint>
+#include <memory>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+using namespace std;
+
+/* CLiteralColumns - cells holding a plain number or string, stored by column instead of
+ * as one-instruction formulas. The sheet is split into tiles of TILE x TILE cells found
+ * through a hash index; each column of a tile holds a dense array of numbers, an array of
+ * interned strings allocated with its first string, and bitmaps of the rows holding either.
+ * Reading a literal is a hash probe and a bit test, a column of numbers is contiguous.
+ * Copies share the index and the tiles until they change them, like CGrid. */
+class CLiteralColumns {
+public:
+    static constexpr int TILE_BITS = 6;
+    static constexpr int TILE = 1 << TILE_BITS; // tile edge in cells, rows of a column fit one bitmap
+
+    CLiteralColumns() = default;
+
+    CLiteralColumns(const CLiteralColumns &src) = default;
+    CLiteralColumns &operator =(const CLiteralColumns &src) = default;
+
+    CLiteralColumns(CLiteralColumns &&src) noexcept : m_Tiles(src.m_Tiles), m_Size(std::exchange(src.m_Size, 0)) {
+        src.m_Tiles = CShared<CIndex>();
+    }
+
+    CLiteralColumns &operator =(CLiteralColumns &&src) noexcept {
+        m_Tiles = src.m_Tiles;
+        m_Size = std::exchange(src.m_Size, 0);
+        src.m_Tiles = CShared<CIndex>();
+        return *this;
+    }
+
+    size_t size() const { return m_Size; }
+
+    // Literal at pos, an empty value if there is none
+    CCellValue find(CPos pos) const {
+        auto it = m_Tiles->find(tileKey(pos));
+        if (it == m_Tiles->end())
+            return {};
+        const CColumn *column = it->second->m_Columns[pos.getCol() & (TILE - 1)].get();
+        if (!column)
+            return {};
+
+        int row = pos.getRow() & (TILE - 1);
+        uint64_t bit = uint64_t(1) << row;
+        if (column->m_Numbers & bit)
+            return column->m_Number[row];
+        if (column->m_Strings & bit)
+            return (*column->m_String)[row];
+        return {};
+    }
+
+    // Store a number or string literal at pos, an empty value erases it
+    void set(CPos pos, CCellValue value) {
+        if (value.empty()) {
+            erase(pos);
+            return;
+        }
+
+        CTile &tile = m_Tiles.edit()[tileKey(pos)].edit(); // a new tile if there was none
+        unique_ptr<CColumn> &column = tile.m_Columns[pos.getCol() & (TILE - 1)];
+        if (!column)
+            column = make_unique<CColumn>();
+
+        int row = pos.getRow() & (TILE - 1);
+        uint64_t bit = uint64_t(1) << row;
+        if (!((column->m_Numbers | column->m_Strings) & bit)) {
+            tile.m_Size++;
+            m_Size++;
+        }
+        if (value.isNumber()) {
+            column->m_Numbers |= bit;
+            column->m_Strings &= ~bit;
+            column->m_Number[row] = value.number();
+        } else {
+            if (!column->m_String)
+                column->m_String = make_unique<array<const string *, TILE> >();
+            column->m_Strings |= bit;
+            column->m_Numbers &= ~bit;
+            (*column->m_String)[row] = &value.str();
+        }
+    }
+
+    // Remove the literal at pos; returns false if there is none
+    bool erase(CPos pos) {
+        if (find(pos).empty())
+            return false;
+
+        CIndex &index = m_Tiles.edit();
+        auto it = index.find(tileKey(pos));
+        CTile &tile = it->second.edit();
+        unique_ptr<CColumn> &column = tile.m_Columns[pos.getCol() & (TILE - 1)];
+        uint64_t bit = uint64_t(1) << (pos.getRow() & (TILE - 1));
+
+        column->m_Numbers &= ~bit;
+        column->m_Strings &= ~bit;
+        if (!column->m_Numbers && !column->m_Strings)
+            column.reset();
+        m_Size--;
+        if (!--tile.m_Size)
+            index.erase(it);
+        return true;
+    }
+
+    void clear() {
+        m_Tiles = CShared<CIndex>();
+        m_Size = 0;
+    }
+
+    /* Call f(pos, value) for every literal: tile by tile, ordered by the column and then the
+     * row of the tiles, and column by column within a tile (the order of CGrid::forEach). */
+    template <class F>
+    void forEach(F &&f) const {
+        vector<pair<uint64_t, const CTile *> > tiles;
+        for (const auto &[key, tile]: *m_Tiles)
+            tiles.emplace_back(key, &*tile);
+        sort(tiles.begin(), tiles.end(), [](const auto &a, const auto &b) {
+            return make_pair((int32_t) (a.first >> 32), (int32_t) (uint32_t) a.first)
+                   < make_pair((int32_t) (b.first >> 32), (int32_t) (uint32_t) b.first);
+        });
+
+        for (const auto &[key, tile]: tiles) {
+            int col = (int) (int32_t) (key >> 32) * TILE;
+            int row = (int) (int32_t) (uint32_t) key * TILE;
+            for (int i = 0; i < TILE; i++) {
+                const CColumn *column = tile->m_Columns[i].get();
+                if (!column)
+                    continue;
+                for (uint64_t rows = column->m_Numbers | column->m_Strings; rows; rows &= rows - 1) {
+                    int j = countr_zero(rows);
+                    f(CPos(col + i, row + j), column->m_Numbers >> j & 1 ? CCellValue(column->m_Number[j])
+                                                                         : CCellValue((*column->m_String)[j]));
+                }
+            }
+        }
+    }
+
+    // Move the strings into another pool
+    void internStrings(CStringPool &pool) {
+        for (auto &[key, tile]: m_Tiles.edit())
+            for (auto &column: tile.edit().m_Columns)
+                if (column)
+                    for (uint64_t rows = column->m_Strings; rows; rows &= rows - 1) {
+                        const string *&str = (*column->m_String)[countr_zero(rows)];
+                        str = pool.intern(*str);
+                    }
+    }
+
+private:
+    // Literals of one column of a tile
+    struct CColumn {
+        uint64_t m_Numbers{0};                             // rows holding a number
+        uint64_t m_Strings{0};                             // rows holding a string
+        array<double, TILE> m_Number;
+        unique_ptr<array<const string *, TILE> > m_String; // interned in the pool of the sheet
+
+        CColumn() = default;
+
+        CColumn(const CColumn &src) : m_Numbers(src.m_Numbers), m_Strings(src.m_Strings), m_Number(src.m_Number) {
+            if (src.m_String)
+                m_String = make_unique<array<const string *, TILE> >(*src.m_String);
+        }
+    };
+
+    struct CTile {
+        array<unique_ptr<CColumn>, TILE> m_Columns; // allocated with their first literal
+        uint32_t m_Size{0};                         // literals in the tile
+
+        CTile() = default;
+
+        CTile(const CTile &src) : m_Size(src.m_Size) {
+            for (int i = 0; i < TILE; i++)
+                if (src.m_Columns[i])
+                    m_Columns[i] = make_unique<CColumn>(*src.m_Columns[i]);
+        }
+    };
+
+    using CIndex = unordered_map<uint64_t, CShared<CTile> >;
+
+    CShared<CIndex> m_Tiles; // tiles by tileKey
+    size_t m_Size{0};
+
+    // Column and row of the tile holding pos, packed like the keys of CGrid
+    static uint64_t tileKey(CPos pos) {
+        return (uint64_t) (uint32_t) (pos.getCol() >> TILE_BITS) << 32 | (uint32_t) (pos.getRow() >> TILE_BITS);
+    }
+};
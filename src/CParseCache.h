@@ -0,0 +1,133 @@
+#pragma once
+#include "CPos.h"
+#include "CCellValue.h"
+#include "CFormula.h"
+#include <chrono>
+#include <cstddef>
+#include <cstdint>
+#include <list>
+#include <memory_resource>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+using namespace std;
+
+/* CParseCache - formulas already compiled by a sheet, by their key (see CParser::normalize):
+ * the text with relative references rewritten as offsets from the cell holding the formula.
+ * A formula found for another cell is moved there like a copy (see CFormula::changePosition)
+ * and shares its instructions, nothing is parsed or allocated. Bounded by a number of
+ * formulas, the least recently used one is forgotten first. */
+class CParseCache {
+public:
+    static constexpr size_t DEFAULT_LIMIT = 4096;
+
+    // Lookups since the cache was created, and the parsing they saved
+    struct CStats {
+        size_t m_Hits{0};
+        size_t m_Misses{0};
+        uint64_t m_ParseNs{0}; // time spent compiling the formulas that were missed
+        uint64_t m_HitNs{0};   // time spent finding the hits and moving them to their cells
+
+        double hitRate() const { return m_Hits + m_Misses ? (double) m_Hits / (double) (m_Hits + m_Misses) : 0; }
+
+        /* Estimated time the hits saved: compiling each at the average cost of a miss, less the
+         * time they took instead. Charging a hit with the first parse of its key would count the
+         * cold start of that parse once per hit. */
+        uint64_t savedNs() const {
+            if (!m_Misses)
+                return 0;
+            double parsed = (double) m_ParseNs / (double) m_Misses * (double) m_Hits;
+            return parsed > (double) m_HitNs ? (uint64_t) (parsed - (double) m_HitNs) : 0;
+        }
+    };
+
+    explicit CParseCache(size_t limit = DEFAULT_LIMIT) : m_Limit(limit) {}
+
+    // The index points into the entries, moving keeps it valid but a copy would not
+    CParseCache(const CParseCache &) = delete;
+    CParseCache &operator =(const CParseCache &) = delete;
+    CParseCache(CParseCache &&) = default;
+    CParseCache &operator =(CParseCache &&) = default;
+
+    // Maximal number of cached formulas, 0 disables the cache
+    size_t limit() const { return m_Limit; }
+
+    void setLimit(size_t limit) {
+        m_Limit = limit;
+        trim();
+    }
+
+    size_t size() const { return m_Entries.size(); }
+    const CStats &stats() const { return m_Stats; }
+
+    // Formula of the key placed in the cell host, or false if it is not cached (counted as a miss)
+    bool find(string_view key, CPos host, CFormula &formula) {
+        auto start = chrono::steady_clock::now();
+        auto it = m_Index.find(key);
+        if (it == m_Index.end()) {
+            m_Stats.m_Misses++;
+            return false;
+        }
+
+        // A formula whose references would leave the range of CPos at host is parsed there instead
+        const CEntry &entry = *it->second;
+        CFormula moved = entry.m_Formula;
+        try {
+            moved.changePosition(host.getCol() - entry.m_Host.getCol(), host.getRow() - entry.m_Host.getRow());
+        } catch (const invalid_argument &) {
+            m_Stats.m_Misses++;
+            return false;
+        }
+        m_Entries.splice(m_Entries.begin(), m_Entries, it->second);
+        formula = std::move(moved);
+        m_Stats.m_Hits++;
+        m_Stats.m_HitNs += (uint64_t) chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        return true;
+    }
+
+    // Cache the formula of a missed key, placed in host and compiled in parseNs nanoseconds
+    void insert(string_view key, CPos host, const CFormula &formula, uint64_t parseNs) {
+        m_Stats.m_ParseNs += parseNs;
+        if (!m_Limit || m_Index.count(key))
+            return;
+        m_Entries.push_front({string(key), host, formula});
+        m_Index.emplace(m_Entries.front().m_Key, m_Entries.begin());
+        trim();
+    }
+
+    void clear() {
+        m_Index.clear();
+        m_Entries.clear();
+    }
+
+    // Move the strings of the cached formulas into another pool (see CFormula::internStrings)
+    void internStrings(CStringPool &pool, pmr::memory_resource &arena, CFormula::CMoved &moved) {
+        for (auto &entry: m_Entries)
+            entry.m_Formula.internStrings(pool, arena, moved);
+    }
+
+    // Move the instructions of the cached formulas into another arena (see CFormula::relocate)
+    void relocate(pmr::memory_resource &arena, CFormula::CMoved &moved) {
+        for (auto &entry: m_Entries)
+            entry.m_Formula.relocate(arena, moved);
+    }
+
+private:
+    struct CEntry {
+        string m_Key;
+        CPos m_Host;         // cell the formula was compiled for
+        CFormula m_Formula;
+    };
+
+    size_t m_Limit;
+    list<CEntry> m_Entries; // most recently used first
+    unordered_map<string_view, list<CEntry>::iterator> m_Index; // keys point into the entries
+    CStats m_Stats;
+
+    void trim() {
+        while (m_Entries.size() > m_Limit) {
+            m_Index.erase(m_Entries.back().m_Key);
+            m_Entries.pop_back();
+        }
+    }
+};
@@ -0,0 +1,391 @@
+#pragma once
+#include "CFormula.h"
+#include "CCellValue.h"
+#include "CPos.h"
+#include <charconv>
+#include <cmath>
+#include <cstdint>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <system_error>
+#include <utility>
+#include <vector>
+using namespace std;
+
+/* CParser - parser of cell contents compiling them straight into a CFormula. Accepts the
+ * grammar of parseExpression: contents not starting with '=' are a number (the whole
+ * contents, optionally followed by spaces) or else a string taken verbatim; a formula
+ * after '=' holds numbers, "strings" ("" for a quote), cell references and the operators
+ * below, from the loosest binding (all left associative):
+ *     =  <>
+ *     <  <=  >  >=
+ *     +  -
+ *     *  /
+ *     -x           (negates a whole chain of ^, -2^2 is -4)
+ *     ^            (its right operand cannot start with -)
+ * Operators wait on an own stack until their operands are emitted (operator precedence
+ * parsing), so nested parentheses of any depth need no recursion. Invalid contents throw
+ * invalid_argument describing the error and its position, like parseExpression. */
+class CParser {
+public:
+    CParser() = default;
+
+    // Compile contents into the formula of the parser, string literals are interned into strings
+    void parse(string_view contents, CStringPool &strings) {
+        m_Formula.clear();
+        CCellValue literal;
+        if (parseLiteral(contents, strings, literal)) {
+            if (literal.isString())
+                m_Formula.pushString(&literal.str());
+            else
+                m_Formula.pushNumber(literal.number());
+            return;
+        }
+        m_Contents = contents;
+        m_Ptr = contents.data();
+        m_End = contents.data() + contents.size();
+        if (contents.empty())
+            fail("Unexpected token <EOF>", m_Ptr);
+
+        m_Ptr++;
+        m_Operators.clear();
+        bool operand = true; // an operand is expected, else an operator
+        for (;;) {
+            next();
+            if (operand) {
+                switch (m_Token) {
+                    case EToken::Number:
+                        m_Formula.pushNumber(m_Number);
+                        break;
+                    case EToken::String:
+                        m_Formula.pushString(strings.intern(m_Text));
+                        break;
+                    case EToken::Reference:
+                        m_Formula.pushReference(m_Reference);
+                        break;
+                    case EToken::Operator:
+                        // Negation, not as the exponent
+                        if (m_Op != EOpcode::Sub || (!m_Operators.empty() && m_Operators.back() == EOpcode::Pow))
+                            unexpected();
+                        m_Operators.push_back(EOpcode::Neg);
+                        continue;
+                    case EToken::Open:
+                        m_Operators.push_back(OPEN);
+                        continue;
+                    default:
+                        unexpected();
+                }
+                operand = false;
+                continue;
+            }
+
+            switch (m_Token) {
+                case EToken::Operator:
+                    popOperators(precedence(m_Op));
+                    m_Operators.push_back(m_Op);
+                    operand = true;
+                    break;
+                case EToken::Close:
+                    popOperators(0);
+                    if (m_Operators.empty())
+                        fail("Unexpected extra token(s)", m_TokenBegin);
+                    m_Operators.pop_back();
+                    break;
+                case EToken::End:
+                    popOperators(0);
+                    if (!m_Operators.empty())
+                        fail("Missing )", m_TokenBegin);
+                    return;
+                default:
+                    popOperators(0);
+                    fail(m_Operators.empty() ? "Unexpected extra token(s)" : "Missing )", m_TokenBegin);
+            }
+        }
+    }
+
+    /* Value of contents that are no formula (not starting with '='), without compiling them:
+     * a number if the whole contents are one, optionally negative and followed by spaces,
+     * else the contents as a string interned into strings. The same value parse compiles,
+     * numbers are rounded alike. Returns false for a formula and for empty contents. */
+    bool parseLiteral(string_view contents, CStringPool &strings, CCellValue &value) {
+        if (contents.empty() || contents[0] == '=')
+            return false;
+
+        m_End = contents.data() + contents.size();
+        const char *digits = contents.data() + (contents[0] == '-');
+        double number;
+        const char *end = readNumber(digits, number);
+        if (end && end != digits && onlySpaces(end))
+            value = digits == contents.data() ? number : -number;
+        else
+            value = strings.intern(contents);
+        return true;
+    }
+
+    /* Key of a formula independent of the cell holding it (see CParseCache): its tokens, each
+     * followed by a space, with relative references rewritten as offsets from host, so "=B2*C2"
+     * in A2 and "=B3*C3" in A3 share one key. Returns false for contents without '=' and for
+     * invalid formulas, they have no key. */
+    bool normalize(string_view contents, CPos host, string &key) {
+        key.clear();
+        if (contents.empty() || contents[0] != '=')
+            return false;
+
+        m_Contents = contents;
+        m_Ptr = contents.data() + 1;
+        m_End = contents.data() + contents.size();
+        try {
+            for (next(); m_Token != EToken::End; next()) {
+                if (m_Token == EToken::Reference) {
+                    // '@' starts no other token
+                    key += '@';
+                    appendCoordinate(key, m_Reference.isAbsCol(), m_Reference.getCol(), host.getCol());
+                    appendCoordinate(key, m_Reference.isAbsRow(), m_Reference.getRow(), host.getRow());
+                } else
+                    key.append(m_TokenBegin, m_Ptr);
+                key += ' ';
+            }
+        } catch (const invalid_argument &) {
+            return false;
+        }
+        return true;
+    }
+
+    // Hands over the compiled formula and leaves the parser empty
+    CFormula takeFormula() {
+        return std::exchange(m_Formula, CFormula());
+    }
+
+    // Formula compiled by the last parse, the caller may simplify it and keep a placed copy (see CFormula::placed)
+    CFormula &formula() {
+        return m_Formula;
+    }
+
+private:
+    enum class EToken : uint8_t { End, Number, String, Reference, Operator, Open, Close };
+
+    static constexpr EOpcode OPEN = EOpcode::Reference; // '(' on the stack of operators
+
+    CFormula m_Formula;           // instructions compiled so far, in postfix order
+    vector<EOpcode> m_Operators;  // operators waiting for their right operand, and open parentheses
+    string m_Text;                // value of the last string token
+    string_view m_Contents;
+    const char *m_Ptr{nullptr};
+    const char *m_End{nullptr};
+
+    // Last token read by next()
+    EToken m_Token{EToken::End};
+    const char *m_TokenBegin{nullptr};
+    EOpcode m_Op{EOpcode::Add};
+    double m_Number{0};
+    CPos m_Reference{0, 0};
+
+    // Binding of binary operators and of the negation, 0 for an open parenthesis
+    static int precedence(EOpcode op) {
+        switch (op) {
+            case EOpcode::Eq: case EOpcode::Ne:
+                return 1;
+            case EOpcode::Lt: case EOpcode::Le: case EOpcode::Gt: case EOpcode::Ge:
+                return 2;
+            case EOpcode::Add: case EOpcode::Sub:
+                return 3;
+            case EOpcode::Mul: case EOpcode::Div:
+                return 4;
+            case EOpcode::Neg:
+                return 5;
+            case EOpcode::Pow:
+                return 6;
+            default:
+                return 0;
+        }
+    }
+
+    // Emit the waiting operators binding at least as tightly as the given precedence
+    void popOperators(int minPrecedence) {
+        while (!m_Operators.empty() && m_Operators.back() != OPEN && precedence(m_Operators.back()) >= minPrecedence) {
+            m_Formula.pushOperator(m_Operators.back());
+            m_Operators.pop_back();
+        }
+    }
+
+    static bool isSpace(char c) {
+        return c == ' ' || (c >= '\t' && c <= '\r');
+    }
+
+    static bool isLetter(char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    }
+
+    static bool isDigit(char c) {
+        return c >= '0' && c <= '9';
+    }
+
+    bool onlySpaces(const char *ptr) const {
+        for (; ptr != m_End; ptr++)
+            if (!isSpace(*ptr))
+                return false;
+        return true;
+    }
+
+    /* Read the number at ptr: digits, optionally a '.' with digits and an exponent. The value
+     * is computed digit by digit in the order of parseExpression, so both round alike (neither
+     * rounds correctly, 1e23 is 1.0000000000000001e23) and cells keep their values. Returns
+     * the end of the number, ptr itself if there is no digit, or null if the exponent has none. */
+    const char *readNumber(const char *ptr, double &number) const {
+        const char *begin = ptr;
+        number = 0;
+        for (; ptr != m_End && isDigit(*ptr); ptr++)
+            number = number * 10 + *ptr - '0';
+        if (ptr == begin)
+            return ptr;
+
+        if (ptr != m_End && *ptr == '.') {
+            double fraction = 0, divisor = 1;
+            for (ptr++; ptr != m_End && isDigit(*ptr); ptr++) {
+                fraction = fraction * 10 + *ptr - '0';
+                divisor *= 10;
+            }
+            number += fraction / divisor;
+        }
+
+        if (ptr != m_End && (*ptr == 'e' || *ptr == 'E')) {
+            ptr++;
+            uint32_t sign = 1;
+            if (ptr != m_End && (*ptr == '+' || *ptr == '-'))
+                sign = *ptr++ == '-' ? -1 : 1;
+            if (ptr == m_End || !isDigit(*ptr))
+                return nullptr;
+            uint32_t exponent = 0; // wraps around like the int of parseExpression
+            for (; ptr != m_End && isDigit(*ptr); ptr++)
+                exponent = exponent * 10 + (*ptr - '0');
+            number *= pow(10.0, (double) (int32_t) (sign * exponent));
+        }
+        return ptr;
+    }
+
+    // Read the next token of a formula
+    void next() {
+        while (m_Ptr != m_End && isSpace(*m_Ptr))
+            m_Ptr++;
+        m_TokenBegin = m_Ptr;
+        if (m_Ptr == m_End) {
+            m_Token = EToken::End;
+            return;
+        }
+
+        char c = *m_Ptr;
+        if (isDigit(c)) {
+            const char *end = readNumber(m_Ptr, m_Number);
+            if (!end)
+                fail("Invalid number", m_Ptr);
+            m_Ptr = end;
+            m_Token = EToken::Number;
+        } else if (c == '"')
+            readString();
+        else if (c == '$' || isLetter(c))
+            readReference();
+        else if (c == '(' || c == ')') {
+            m_Ptr++;
+            m_Token = c == '(' ? EToken::Open : EToken::Close;
+        } else {
+            readOperator();
+            m_Token = EToken::Operator;
+        }
+    }
+
+    // String literal, a doubled quote stands for one quote
+    void readString() {
+        m_Text.clear();
+        for (const char *ptr = m_Ptr + 1;; ptr++) {
+            const char *quote = ptr;
+            while (quote != m_End && *quote != '"')
+                quote++;
+            if (quote == m_End)
+                fail("Missing string terminator", m_End);
+            m_Text.append(ptr, quote);
+            ptr = quote + 1;
+            if (ptr == m_End || *ptr != '"') {
+                m_Ptr = ptr;
+                m_Token = EToken::String;
+                return;
+            }
+            m_Text += '"';
+        }
+    }
+
+    // Cell reference like A1 or $B$2; other identifiers would be functions, none are supported
+    void readReference() {
+        from_chars_result result = CPos::fromChars(m_Ptr, m_End, m_Reference);
+        if (result.ec == errc::result_out_of_range)
+            fail("Cell identifier out of range", result.ptr);
+        if (result.ec == errc()) {
+            if (result.ptr != m_End && (isLetter(*result.ptr) || *result.ptr == '$' || *result.ptr == ':'))
+                fail("Invalid cell/range", result.ptr);
+            m_Ptr = result.ptr;
+            m_Token = EToken::Reference;
+            return;
+        }
+
+        const char *ptr = m_Ptr + (*m_Ptr == '$');
+        const char *letters = ptr;
+        while (ptr != m_End && isLetter(*ptr))
+            ptr++;
+        if (ptr == letters)
+            fail("Missing column id", ptr);
+        if (ptr != m_End && *ptr == '$')
+            fail("Missing cell row", ptr + 1);
+
+        string_view name(letters, ptr - letters);
+        while (ptr != m_End && isSpace(*ptr))
+            ptr++;
+        if (*m_Ptr != '$' && ptr != m_End && *ptr == '(')
+            fail("Unknown function " + string(name), ptr);
+        fail("Invalid cell/range", ptr);
+    }
+
+    void readOperator() {
+        char c = *m_Ptr++;
+        char following = m_Ptr != m_End ? *m_Ptr : '\0';
+        switch (c) {
+            case '+': m_Op = EOpcode::Add; return;
+            case '-': m_Op = EOpcode::Sub; return;
+            case '*': m_Op = EOpcode::Mul; return;
+            case '/': m_Op = EOpcode::Div; return;
+            case '^': m_Op = EOpcode::Pow; return;
+            case '=': m_Op = EOpcode::Eq; return;
+            case '<':
+                m_Op = following == '=' ? EOpcode::Le : following == '>' ? EOpcode::Ne : EOpcode::Lt;
+                m_Ptr += m_Op != EOpcode::Lt;
+                return;
+            case '>':
+                m_Op = following == '=' ? EOpcode::Ge : EOpcode::Gt;
+                m_Ptr += m_Op != EOpcode::Gt;
+                return;
+            default:
+                fail("Unknown char sequence", m_Ptr - 1);
+        }
+    }
+
+    // Absolute coordinate as '$' and its value, relative one as '~' and its offset from host
+    static void appendCoordinate(string &key, bool absolute, int value, int host) {
+        char buffer[16];
+        buffer[0] = absolute ? '$' : '~';
+        char *end = to_chars(buffer + 1, buffer + sizeof(buffer), absolute ? value : value - host).ptr;
+        key.append(buffer, end);
+    }
+
+    [[noreturn]] void unexpected() const {
+        if (m_Token == EToken::End)
+            fail("Unexpected token <EOF>", m_TokenBegin);
+        fail("Unexpected token " + string(m_TokenBegin, m_Ptr), m_TokenBegin);
+    }
+
+    // Throw the error with the contents and a mark under its position, as parseExpression does
+    [[noreturn]] void fail(const string &message, const char *at) const {
+        string text = message + "\n";
+        text.append(m_Contents);
+        text += "\n" + string(at - m_Contents.data(), ' ') + "^\n";
+        throw invalid_argument(text);
+    }
+};
@@ -1,113 +1,193 @@
 #pragma once
 #include <string_view>
-#include <cctype>
+#include <charconv>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
 #include <stdexcept>
 #include <string>
+#include <system_error>
 #include <iostream>
 using namespace std;
 
 /* CPos - Cell Position
  * Represents a spreadsheet cell (e.g., "A7", "$B$2") with support for
  * absolute/relative references. Provides parsing, comparison, and
- * position adjustment. Throws invalid_argument for invalid input. */
+ * position adjustment. Throws invalid_argument for invalid input,
+ * fromChars parses without exceptions.
+ * The position is packed into one 64-bit key: the column, the row (both biased, so the
+ * key orders like the positions) and the two absolute flags in the lowest bits. Columns
+ * and rows range over [MIN, MAX]; changePosition, setCol and setRow reject positions
+ * outside of it, the constructor from numbers expects them within. */
 class CPos {
 public:
+    static constexpr int32_t MIN = -(1 << 30);
+    static constexpr int32_t MAX = (1 << 30) - 1;
+
     /* Constructor: parses a string like "A1", "$B$2", etc. into a CPos object.
    Supports absolute column ($) and absolute row ($) references.  */
-    explicit CPos(string_view str) : m_Col(0), m_Row(0) {
-        // Find first digit which separates column and row
-        size_t pos = str.find_first_of("0123456789");
-        if (pos >= str.length() || pos == 0)
-            throw invalid_argument("No integer or letter in cell identifier.");
-
-        // Extract column and row parts
-        string_view columnStr = str.substr(0, pos);
-        string_view rowStr = str.substr(pos);
-
-        // Absolute column
-        if (!columnStr.empty() && columnStr.front() == '$') {
-            m_AbsCol = true;
-            columnStr.remove_prefix(1); // Remove the '$' character
-        }
+    explicit CPos(string_view str) {
+        const char *end = str.data() + str.size();
+        from_chars_result result = fromChars(str.data(), end, *this);
+        if (result.ec == errc::result_out_of_range)
+            throw invalid_argument("Cell identifier out of range.");
+        if (result.ec != errc() || result.ptr != end)
+            throw invalid_argument("Invalid cell identifier.");
+    }
 
-        // Absolute row
-        if (!columnStr.empty() && columnStr.back() == '$') {
-            m_AbsRow = true;
-            columnStr.remove_suffix(1); // Remove the '$' character
-        }
+    // Constructor from zero-based column, row and absolute flags
+    constexpr CPos(int col, int row, bool absCol = false, bool absRow = false) : m_Key(pack(col, row, absCol, absRow)) {
+    }
 
-        // Validate column letters
-        if (columnStr.empty())
-            throw invalid_argument("Missing column letters in cell identifier.");
+    /* Parse a cell identifier at the beginning of [first, last) like from_chars: the optional
+     * '$', column letters (either case), the optional '$' and row digits. Returns the end of
+     * the identifier; invalid_argument if there is none there and pos is unchanged, or
+     * result_out_of_range if the column or row exceeds MAX. */
+    static constexpr from_chars_result fromChars(const char *first, const char *last, CPos &pos) noexcept {
+        const char *ptr = first;
+        bool absCol = ptr != last && *ptr == '$';
+        ptr += absCol;
+
+        const char *letters = ptr;
+        int64_t col = 0;
+        for (; ptr != last && isLetter(*ptr); ptr++)
+            if (col <= MAX)
+                col = col * 26 + ((*ptr | 0x20) - 'a' + 1);
+        if (ptr == letters)
+            return {first, errc::invalid_argument};
+
+        bool absRow = ptr != last && *ptr == '$';
+        ptr += absRow;
+
+        const char *digits = ptr;
+        int64_t row = 0;
+        for (; ptr != last && *ptr >= '0' && *ptr <= '9'; ptr++)
+            if (row <= MAX)
+                row = row * 10 + (*ptr - '0');
+        if (ptr == digits)
+            return {first, errc::invalid_argument};
+        if (col - 1 > MAX || row > MAX)
+            return {ptr, errc::result_out_of_range};
+
+        pos = CPos((int) col - 1, (int) row, absCol, absRow);
+        return {ptr, errc()};
+    }
 
-        // Convert column letters (A, B, ..., AA) to zero-based index
-        for (char c: columnStr) {
-            if (!isalpha(c))
-                throw invalid_argument("Invalid column part in cell identifier.");
-            m_Col *= 26; // (26 letters in the english alphabet)
-            m_Col += tolower(c) - 'a' + 1;
+    // Zero-based index of column letters (either case), -1 if they are not letters or out of range
+    static constexpr int columnIndex(string_view letters) noexcept {
+        int64_t col = 0;
+        for (char c: letters) {
+            if (!isLetter(c))
+                return -1;
+            col = col * 26 + ((c | 0x20) - 'a' + 1);
+            if (col - 1 > MAX)
+                return -1;
         }
-        m_Col--; // zero-based
+        return (int) col - 1;
+    }
 
-        // Convert row string to integer
-        for (char c: rowStr) {
-            if (!isdigit(c))
-                throw invalid_argument("Invalid row part in cell identifier.");
-            m_Row = m_Row * 10 + (c - '0');
-        }
+    // True if a column or row index lies in [MIN, MAX]
+    static constexpr bool inRange(int64_t index) noexcept {
+        return index >= MIN && index <= MAX;
+    }
+
+    static constexpr int COLUMN_LETTERS = 7; // letters of column MAX
+
+    // Write the letters of a zero-based column into buffer (COLUMN_LETTERS long), returns their count
+    static constexpr int columnLetters(int col, char *buffer) noexcept {
+        char reversed[COLUMN_LETTERS];
+        int count = 0;
+        for (int64_t n = (int64_t) col + 1; n > 0 && count < COLUMN_LETTERS; n = (n - 1) / 26)
+            reversed[count++] = char('A' + (n - 1) % 26);
+        for (int i = 0; i < count; i++)
+            buffer[i] = reversed[count - 1 - i];
+        return count;
     }
 
-    // Lexicographical comparison (needed for using CPos as map key)
+    // Lexicographical comparison by column and row (needed for using CPos as map key)
     bool operator <(const CPos &other) const {
-        if (m_Col != other.m_Col)
-            return m_Col < other.m_Col;
-        return m_Row < other.m_Row;
+        return (m_Key >> FLAGS) < (other.m_Key >> FLAGS);
     }
 
-    // Change position by offset (respects absolute flags)
+    // Same cell, whatever the absolute flags (consistent with operator <)
+    bool operator ==(const CPos &other) const {
+        return (m_Key >> FLAGS) == (other.m_Key >> FLAGS);
+    }
+
+    /* Change position by offset (respects absolute flags). Throws invalid_argument and keeps
+     * the position if the column or row would leave [MIN, MAX]. */
     void changePosition(int colOffset, int rowOffset) {
-        if (!m_AbsCol) m_Col += colOffset;
-        if (!m_AbsRow) m_Row += rowOffset;
+        int64_t col = (int64_t) getCol() + (isAbsCol() ? 0 : colOffset);
+        int64_t row = (int64_t) getRow() + (isAbsRow() ? 0 : rowOffset);
+        if (!inRange(col) || !inRange(row))
+            throw invalid_argument("Position out of range.");
+        m_Key = pack((int) col, (int) row, isAbsCol(), isAbsRow());
     }
 
     // Stream output: prints a CPos in the standard format (e.g., "CPos $A$1")
     friend ostream &operator <<(ostream &os, const CPos &pos) {
         os << " CPos ";
-        if (pos.m_AbsCol) os << "$";
+        if (pos.isAbsCol()) os << "$";
 
         // Convert zero-based column to letters
-        int col = pos.m_Col + 1;
-        string result;
-        while (col > 0) {
-            int rem = (col - 1) % 26;
-            result.insert(result.begin(), char('A' + rem));
-            col = (col - rem - 1) / 26;
-        }
-        os << result;
+        char letters[COLUMN_LETTERS];
+        os.write(letters, columnLetters(pos.getCol(), letters));
 
-        if (pos.m_AbsRow) os << "$";
-        os << pos.m_Row;
+        if (pos.isAbsRow()) os << "$";
+        os << pos.getRow();
 
         return os;
     }
 
     // Public getters and setters for column and row
-    int getCol() const { return m_Col; }
-    int getRow() const { return m_Row; }
+    int getCol() const { return (int) (m_Key >> COL_SHIFT) + MIN; }
+    int getRow() const { return (int) ((m_Key >> ROW_SHIFT) & FIELD_MASK) + MIN; }
+    bool isAbsCol() const { return m_Key & ABS_COL; }
+    bool isAbsRow() const { return m_Key & ABS_ROW; }
+
+    // Packed column, row and absolute flags
+    uint64_t key() const { return m_Key; }
+
+    // Hash of the cell, whatever the absolute flags; neighbouring cells spread over all bits
+    size_t hash() const {
+        uint64_t h = (m_Key >> FLAGS) * 0x9E3779B97F4A7C15ull;
+        return (size_t) (h ^ (h >> 32));
+    }
 
+    // Set the column or row, both in [0, MAX]; throws invalid_argument otherwise
     void setCol(int col) {
-        if (col >= 0) m_Col = col;
+        if (col >= 0 && col <= MAX) m_Key = pack(col, getRow(), isAbsCol(), isAbsRow());
         else throw invalid_argument("Invalid column");
     }
 
     void setRow(int row) {
-        if (row >= 0) m_Row = row;
+        if (row >= 0 && row <= MAX) m_Key = pack(getCol(), row, isAbsCol(), isAbsRow());
         else throw invalid_argument("Invalid row");
     }
 
 private:
-    int m_Col{0};
-    int m_Row{0};
-    bool m_AbsCol{false};
-    bool m_AbsRow{false};
+    static constexpr int FLAGS = 2;                   // bits of the absolute flags
+    static constexpr int ROW_SHIFT = FLAGS;
+    static constexpr int COL_SHIFT = ROW_SHIFT + 31;
+    static constexpr uint64_t FIELD_MASK = (uint64_t(1) << 31) - 1;
+    static constexpr uint64_t ABS_COL = 2;
+    static constexpr uint64_t ABS_ROW = 1;
+
+    uint64_t m_Key{pack(0, 0, false, false)};
+
+    static constexpr uint64_t pack(int col, int row, bool absCol, bool absRow) {
+        return ((uint64_t) ((int64_t) col - MIN) & FIELD_MASK) << COL_SHIFT
+               | ((uint64_t) ((int64_t) row - MIN) & FIELD_MASK) << ROW_SHIFT
+               | (absCol ? ABS_COL : 0) | (absRow ? ABS_ROW : 0);
+    }
+
+    static constexpr bool isLetter(char c) {
+        return (c >= 'a' && c <= 'z') || (c >= 'A' && c <= 'Z');
+    }
+};
+
+// Hash for unordered containers keyed by cells
+template <>
+struct std::hash<CPos> {
+    size_t operator ()(const CPos &pos) const noexcept { return pos.hash(); }
 };
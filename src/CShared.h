@@ -0,0 +1,101 @@
+#pragma once
+#include <atomic>
+#include <memory>
+#include <utility>
+using namespace std;
+
+/* CCounted - shared_ptr that counts its copies itself, to tell whether it is the only one.
+ * use_count() of shared_ptr is a relaxed read: a copy found alone could still race with
+ * what another thread did through a copy it has just released. Here every copy going away
+ * releases the count and unique() acquires it, so a value found unshared may be changed
+ * even if the other copies lived on other threads. Empty (null) by default. */
+template <class T>
+class CCounted {
+public:
+    CCounted() = default;
+
+    CCounted(const CCounted &src) : m_Box(src.m_Box) {
+        if (m_Box)
+            m_Box->m_Copies.fetch_add(1, memory_order_relaxed);
+    }
+
+    CCounted(CCounted &&src) noexcept = default;
+
+    CCounted &operator =(CCounted src) noexcept {
+        std::swap(m_Box, src.m_Box);
+        return *this;
+    }
+
+    ~CCounted() { reset(); }
+
+    // New value constructed from args, on the heap or by alloc
+    template <class... TArgs>
+    static CCounted make(TArgs &&... args) {
+        CCounted counted;
+        counted.m_Box = make_shared<CBox>(std::forward<TArgs>(args)...);
+        return counted;
+    }
+
+    template <class TAlloc, class... TArgs>
+    static CCounted allocate(const TAlloc &alloc, TArgs &&... args) {
+        CCounted counted;
+        counted.m_Box = allocate_shared<CBox>(alloc, std::forward<TArgs>(args)...);
+        return counted;
+    }
+
+    void reset() {
+        if (m_Box)
+            m_Box->m_Copies.fetch_sub(1, memory_order_release);
+        m_Box.reset();
+    }
+
+    // True if no other copy refers to the value, which may then be changed
+    bool unique() const { return m_Box && m_Box->m_Copies.load(memory_order_acquire) == 1; }
+
+    T *get() const { return m_Box ? &m_Box->m_Value : nullptr; }
+    T &operator *() const { return m_Box->m_Value; }
+    T *operator ->() const { return &m_Box->m_Value; }
+    explicit operator bool() const { return (bool) m_Box; }
+    bool operator ==(const CCounted &other) const { return m_Box == other.m_Box; }
+
+private:
+    struct CBox {
+        template <class... TArgs>
+        explicit CBox(TArgs &&... args) : m_Value(std::forward<TArgs>(args)...) {}
+
+        atomic<long> m_Copies{1};
+        T m_Value;
+    };
+
+    shared_ptr<CBox> m_Box;
+};
+
+/* CShared - value shared by all copies until one of them changes it (copy on write).
+ * Copying is O(1); edit() gives the value to be changed and copies it first if other
+ * copies still share it, so a change never shows through another copy. References
+ * returned by edit() stay valid until the CShared is copied again. A moved-from CShared
+ * still shares the value. Copies may be edited on different threads (see CCounted). */
+template <class T>
+class CShared {
+public:
+    CShared() : m_Value(CCounted<T>::make()) {}
+
+    CShared(const CShared &) = default;
+    CShared &operator =(const CShared &) = default;
+
+    const T &operator *() const { return *m_Value; }
+    const T *operator ->() const { return m_Value.get(); }
+
+    // Value to be changed, no longer shared with any copy
+    T &edit() {
+        if (!m_Value.unique())
+            m_Value = CCounted<T>::make(*m_Value);
+        return *m_Value;
+    }
+
+    // True if both refer to the same value, e.g. one is an unchanged copy of the other
+    bool shares(const CShared &other) const { return m_Value == other.m_Value; }
+
+private:
+    CCounted<T> m_Value;
+};
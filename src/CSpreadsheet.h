@@ -1,54 +1,484 @@
 #pragma once
-#include "ExpressionBuilder.h"
+#include "CParser.h"
+#include "CThreadPool.h"
+#include "CCellValue.h"
+#include "CColumnKernel.h"
+#include "CGrid.h"
+#include "CLiteralColumns.h"
+#include "CArena.h"
+#include "CShared.h"
+#include "CJournal.h"
+#include "CParseCache.h"
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <chrono>
 #include <map>
 #include <set>
 #include <vector>
 #include <memory>
+#include <mutex>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <utility>
 using namespace std;
 
 constexpr unsigned SPREADSHEET_CYCLIC_DEPS = 1;
 
-// Represents a spreadsheet storing expressions per cell and supporting evaluation
+/* Represents a spreadsheet storing expressions per cell and supporting evaluation.
+ * Any number of threads may read values at once; edits, loading and evaluation of dirty
+ * cells take the sheet exclusively. */
 class CSpreadsheet {
 public:
     CSpreadsheet() = default;
 
     static unsigned capabilities() { return SPREADSHEET_CYCLIC_DEPS; }
 
-    // Copy constructor / assignment: deep copy of all cells and their expressions
+    /* Copy constructor / assignment: O(1) snapshot, the copy shares the tiles of cells and cached
+     * values until either sheet changes them (see CShared), the formulas share their instructions.
+     * The copy keeps the arenas of the source alive and allocates into its own one. The undo
+     * history, the formula cache and the thread pool stay with the source, the copy starts
+     * own ones with the same limits. */
     CSpreadsheet(const CSpreadsheet &src) {
-        // Copy excel map
-        for (const auto &pair: src.m_Excel)
-            m_Excel[pair.first] = copyExpressions(pair.second);
+        shared_lock lock(src.m_Mutex);
+
+        // Copy the cells, the cached strings stay in the shared pool
+        m_Excel = src.m_Excel;
+        shareArenas(src);
+        m_Literals = src.m_Literals;
+        m_DirtyCells = src.m_DirtyCells;
+        m_Cycles = src.m_Cycles;
+        m_NextCycle = src.m_NextCycle;
+        m_Strings = src.m_Strings;
+        m_LiveStrings = src.m_LiveStrings;
+        m_LiveCode = src.m_LiveCode;
+        m_Journal.setLimit(src.m_Journal.limit());
+        m_ParseCache.setLimit(src.m_ParseCache.limit());
     }
 
     CSpreadsheet &operator =(const CSpreadsheet &src) {
         if (this != &src) {
-            // Copy excel map
-            m_Excel.clear();
-            for (const auto &pair: src.m_Excel)
-                m_Excel[pair.first] = copyExpressions(pair.second);
+            unique_lock lockDst(m_Mutex, defer_lock);
+            shared_lock lockSrc(src.m_Mutex, defer_lock);
+            lock(lockDst, lockSrc);
+
+            // Copy the cells, the cached strings stay in the shared pool; the previous cells are gone before their arenas
+            m_Journal = CJournal(src.m_Journal.limit());
+            m_ParseCache = CParseCache(src.m_ParseCache.limit());
+            m_Excel = src.m_Excel;
+            shareArenas(src);
+            m_Literals = src.m_Literals;
+            m_DirtyCells = src.m_DirtyCells;
+            m_Cycles = src.m_Cycles;
+            m_NextCycle = src.m_NextCycle;
+            m_Strings = src.m_Strings;
+            m_LiveStrings = src.m_LiveStrings;
+            m_LiveCode = src.m_LiveCode;
         }
         return *this;
     }
 
-    CSpreadsheet(CSpreadsheet &&src) noexcept : m_Excel(std::move(src.m_Excel)) {
+    CSpreadsheet(CSpreadsheet &&src) noexcept {
+        unique_lock lock(src.m_Mutex);
+        m_Excel = std::move(src.m_Excel);
+        m_Arenas = std::move(src.m_Arenas);
+        src.m_Arenas = {make_shared<CArena>()}; // the source keeps allocating, into a new arena
+        m_Literals = std::move(src.m_Literals);
+        m_DirtyCells = std::exchange(src.m_DirtyCells, {});
+        m_Cycles = std::exchange(src.m_Cycles, {});
+        m_NextCycle = src.m_NextCycle;
+        m_Strings = src.m_Strings; // shared, the source keeps a usable pool
+        m_LiveStrings = src.m_LiveStrings;
+        m_LiveCode = std::exchange(src.m_LiveCode, 0);
+        m_Journal = std::move(src.m_Journal);
+        src.m_Journal.clear();
+        m_ParseCache = std::move(src.m_ParseCache);
+        src.m_ParseCache.clear();
+        m_Pool = std::move(src.m_Pool);
     }
 
     // Load spreadsheet from stream; returns false if input is invalid
     bool load(istream &is) {
+        unique_lock lock(m_Mutex);
+        m_Journal.clear(); // the loaded cells are not an edit to undo
+        m_ParseCache.clear();
         m_Excel.clear();
+        m_Arenas = {make_shared<CArena>()}; // the cleared cells and history released everything the arenas held
+        m_Literals.clear();
+        m_DirtyCells = {};
+        m_Cycles = {};
+        m_Strings = make_shared<CStringPool>();
+        m_LiveStrings = 0;
+        bool success = readCells(is);
+        m_LiveCode = arena().allocated();
+
+        // Link all loaded cells into the dependency graph (also after a failure, the cells stay consistent)
+        vector<CPos> positions;
+        as_const(m_Excel).forEach([&positions](CPos pos, const CCell &) { positions.push_back(pos); });
+        for (const auto &pos: positions) {
+            linkPrecedents(pos);
+            m_Excel[pos].m_Dirty = true;
+            m_DirtyCells.edit().push_back(pos);
+        }
+        splitCycles(positions);
+
+        return success;
+    }
+
+    // Save spreadsheet to stream
+    bool save(ostream &os) const {
+        shared_lock lock(m_Mutex);
+        m_Excel.forEach([&os](CPos pos, const CCell &cell) {
+            // Save cell if it is not empty
+            int size = (int) cell.m_Formula.size();
+            if (size) {
+                // Print position
+                os << pos;
+
+                // Print all expressions
+                os << " VectorLen " << size << " "; // to know how much to read
+                os << cell.m_Formula;
+            }
+        });
+        m_Literals.forEach([&os](CPos pos, CCellValue value) {
+            os << pos << " VectorLen 1 ";
+            CFormula::printLiteral(os, value);
+        });
+
+        return true;
+    }
+
+    // Set contents of a cell (number, string, or expression)
+    bool setCell(CPos pos, const string &contents) {
+        unique_lock lock(m_Mutex);
+        // Compile the contents into instructions (operations, constants, references...)
+        CContents compiled;
+        try {
+            compiled = compile(pos, contents);
+        } catch (const exception &e) {
+            cerr << "Error while parsing input: " << e.what();
+            return false;
+        }
 
+        CChanges changes = beginChanges();
+        storeCell(pos, compiled.m_Literal, std::move(compiled.m_Formula), changes);
+        commitChanges(changes);
+        collectCode();
+        return true;
+    }
+
+    /* Set the contents of many cells at once, later entries of the same cell win. All contents
+     * are parsed first; if one is invalid, the sheet is left unchanged and false is returned.
+     * Dependents are invalidated once for the whole batch instead of after every cell, then
+     * the dirty cells are recalculated in one pass (see recalculate). */
+    bool setCells(span<const pair<CPos, string> > cells, unsigned threads = 1) {
+        unique_lock lock(m_Mutex);
+        // Parse everything before the first change
+        size_t allocated = arena().allocated();
+        vector<CContents> contents(cells.size());
+        for (size_t i = 0; i < cells.size(); i++) {
+            try {
+                contents[i] = compile(cells[i].first, cells[i].second);
+            } catch (const exception &e) {
+                cerr << "Error while parsing input: " << e.what();
+                return false;
+            }
+        }
+
+        // Store the cells and their references, the cycles are kept up to date as by setCell
+        CChanges changes = beginChanges(cells.size());
+        for (size_t i = 0; i < cells.size(); i++)
+            storeCell(cells[i].first, contents[i].m_Literal, std::move(contents[i].m_Formula), changes);
+        commitChanges(changes);
+
+        // The instructions placed by the batch are in use, no reason to collect them right away
+        m_LiveCode += arena().allocated() - allocated;
+        collectCode();
+        recalculateDirty(threads);
+        return true;
+    }
+
+    /* Return value of a cell; returns empty CValue if undefined or cyclic.
+     * A literal is read from its column without evaluation. The result of a formula
+     * is memoized in the cell and reused until the cell is invalidated,
+     * a dirty cell is evaluated together with the dirty cells it depends on, in batches
+     * like by recalculate.
+     * Safe to call from many threads: cached values are read under a shared lock,
+     * only the evaluation of a dirty cell takes the sheet exclusively. */
+    CValue getValue(CPos pos) {
+        {
+            shared_lock lock(m_Mutex);
+            CCellValue literal = m_Literals.find(pos);
+            if (!literal.empty())
+                return literal.toValue();
+
+            // Empty cell
+            const CCell *cell = as_const(m_Excel).find(pos);
+            if (!cell)
+                return {};
+
+            // Cached value is still valid
+            if (!cell->m_Dirty)
+                return cell->m_Value.toValue();
+        }
+
+        // Another thread may have evaluated or edited the cell before the exclusive lock is taken
+        unique_lock lock(m_Mutex);
+        CCellValue literal = m_Literals.find(pos);
+        if (!literal.empty())
+            return literal.toValue();
+        CCell *cell = m_Excel.find(pos);
+        if (!cell)
+            return {};
+        if (cell->m_Dirty) {
+            evaluate(*cell);
+            flushBatches();
+            collectStrings();
+        }
+        return cell->m_Value.toValue();
+    }
+
+    /* Cells of every reference cycle, each cycle sorted by position. The cycles are the
+     * strongly connected components of the dependency graph, kept up to date by every edit;
+     * their cells evaluate to empty values. */
+    vector<vector<CPos> > getCycles() const {
+        shared_lock lock(m_Mutex);
+        vector<vector<CPos> > cycles;
+        for (const auto &pair: *m_Cycles)
+            cycles.push_back(pair.second);
+        return cycles;
+    }
+
+    /* Evaluate all dirty cells, each exactly once and after all cells it refers to. Formulas
+     * sharing a kernel operator that do not depend on each other (e.g. copied down a column)
+     * are evaluated in batches by CColumnKernel. With more than one thread, the dirty cells
+     * are split into dependency levels and the batches of one level are evaluated in
+     * parallel; results match the serial order. The worker threads are kept by the sheet for
+     * later calls with the same number of threads. */
+    void recalculate(unsigned threads = 1) {
+        unique_lock lock(m_Mutex);
+        recalculateDirty(threads);
+    }
+
+    /* Copy a rectangle of cells to a new position (adjusting references). The cells are copied
+     * one by one without staging, in the direction that reads every source cell before it is
+     * overwritten when the rectangles overlap; empty source cells clear their destination.
+     * Throws invalid_argument and leaves the sheet unchanged if a copied cell or a cell referred
+     * to by a copied formula would leave the range of CPos (see CFormula::canMove). */
+    void copyRect(CPos dst, CPos src, int w = 1, int h = 1) {
+        unique_lock lock(m_Mutex);
+        int colOffset = dst.getCol() - src.getCol();
+        int rowOffset = dst.getRow() - src.getRow();
+        if (!inRange(src, w, h) || !inRange(dst, w, h))
+            throw invalid_argument("Position out of range.");
+        for (int col = 0; col < w; col++)
+            for (int row = 0; row < h; row++) {
+                const CCell *cell = as_const(m_Excel).find(CPos(src.getCol() + col, src.getRow() + row));
+                if (cell && !cell->m_Formula.canMove(colOffset, rowOffset))
+                    throw invalid_argument("Position out of range.");
+            }
+        CChanges changes = beginChanges((size_t) max(w, 0) * (size_t) max(h, 0));
+
+        // Moving right (down), the last column (row) is copied first
+        for (int i = 0; i < w; i++) {
+            int col = colOffset > 0 ? w - 1 - i : i;
+            for (int j = 0; j < h; j++) {
+                int row = rowOffset > 0 ? h - 1 - j : j;
+                CPos from(src.getCol() + col, src.getRow() + row);
+                CContents contents = contentsOf(from);
+                contents.m_Formula.changePosition(colOffset, rowOffset);
+                storeCell(CPos(dst.getCol() + col, dst.getRow() + row), contents.m_Literal,
+                          std::move(contents.m_Formula), changes);
+            }
+        }
+        commitChanges(changes);
+    }
+
+    /* Fill a rectangle of w x h cells at dst by repeating the block of srcW x srcH cells at src,
+     * e.g. a formula copied down a whole column; references are adjusted as by copyRect. The
+     * block is read before anything is written, so it may lie inside the filled rectangle.
+     * An empty block fills nothing; throws invalid_argument and leaves the sheet unchanged if
+     * a filled cell would leave the range of CPos, as copyRect. */
+    void fillRect(CPos dst, CPos src, int w, int h, int srcW = 1, int srcH = 1) {
+        unique_lock lock(m_Mutex);
+        if (srcW <= 0 || srcH <= 0)
+            return;
+        if (!inRange(src, srcW, srcH) || !inRange(dst, w, h))
+            throw invalid_argument("Position out of range.");
+
+        vector<CContents> block;
+        block.reserve((size_t) srcW * (size_t) srcH);
+        for (int col = 0; col < srcW; col++)
+            for (int row = 0; row < srcH; row++)
+                block.push_back(contentsOf(CPos(src.getCol() + col, src.getRow() + row)));
+
+        // Offset of the copy of block cell (col % srcW, row % srcH) at (col, row) of the filled rectangle
+        int colOffset = dst.getCol() - src.getCol(), rowOffset = dst.getRow() - src.getRow();
+        for (int col = 0; col < w; col++)
+            for (int row = 0; row < h; row++) {
+                const CFormula &formula = block[(size_t) (col % srcW) * srcH + row % srcH].m_Formula;
+                if (!formula.canMove(colOffset + col - col % srcW, rowOffset + row - row % srcH))
+                    throw invalid_argument("Position out of range.");
+            }
+
+        CChanges changes = beginChanges((size_t) max(w, 0) * (size_t) max(h, 0));
+        for (int col = 0; col < w; col++)
+            for (int row = 0; row < h; row++) {
+                const CContents &contents = block[(size_t) (col % srcW) * srcH + row % srcH];
+                CFormula formula = contents.m_Formula;
+                formula.changePosition(colOffset + col - col % srcW, rowOffset + row - row % srcH);
+                storeCell(CPos(dst.getCol() + col, dst.getRow() + row), contents.m_Literal, std::move(formula), changes);
+            }
+        commitChanges(changes);
+    }
+
+    /* Undo the last edit by setCell, setCells, copyRect or fillRect still in the history:
+     * its cells get back their previous contents, at about the cost of the edit. Returns
+     * false if there is nothing to undo. */
+    bool undo() {
+        unique_lock lock(m_Mutex);
+        if (!m_Journal.canUndo())
+            return false;
+        m_Journal.undone(restore(m_Journal.takeUndo()));
+        return true;
+    }
+
+    // Redo the last undone edit, unless another edit came since; false if there is nothing to redo
+    bool redo() {
+        unique_lock lock(m_Mutex);
+        if (!m_Journal.canRedo())
+            return false;
+        m_Journal.redone(restore(m_Journal.takeRedo()));
+        return true;
+    }
+
+    /* Bound the memory of the undo history, in bytes of records including the instructions
+     * of the recorded formulas; the oldest edits are forgotten first, 0 keeps no history.
+     * The default is CJournal::DEFAULT_LIMIT. */
+    void setUndoLimit(size_t bytes) {
+        unique_lock lock(m_Mutex);
+        m_Journal.setLimit(bytes);
+    }
+
+    /* Bound the number of compiled formulas kept by their normalized text (see CParseCache):
+     * contents repeating a cached formula relative to their cell, like a formula filled down a
+     * column, are not parsed again and share its instructions. 0 disables the cache. The
+     * default is CParseCache::DEFAULT_LIMIT. */
+    void setParseCacheLimit(size_t formulas) {
+        unique_lock lock(m_Mutex);
+        m_ParseCache.setLimit(formulas);
+    }
+
+    // Hits and misses of the formula cache, and the parsing time the hits saved
+    CParseCache::CStats parseCacheStats() const {
+        shared_lock lock(m_Mutex);
+        return m_ParseCache.stats();
+    }
+
+private:
+    /* CCell - contents of one cell together with the memoized result of their evaluation
+     * and its edges in the dependency graph. m_Value is only meaningful while the cell is not dirty.
+     * A cell without expressions may exist only to remember which cells refer to it, e.g.
+     * a literal stored in m_Literals. */
+    class CCell {
+    public:
+        // Collect the cells referred to by the expressions, through a reused scratch buffer
+        set<CPos> getReferences(vector<CPos> &references) const {
+            references.clear();
+            m_Formula.getReferences(references);
+            return {references.begin(), references.end()};
+        }
+
+        // Store an evaluated value
+        void cacheValue(CCellValue value) {
+            m_Value = value;
+            m_Dirty = false;
+        }
+
+        CFormula m_Formula;          // compiled postfix expressions of the cell
+        CCellValue m_Value;          // cached result of the last evaluation, strings live in m_Strings
+        bool m_Dirty{false};         // true if m_Value has to be recomputed
+        bool m_Collected{false};     // set while recalculateLevels collects the dirty cells
+        bool m_Queued{false};        // kernel formula waiting in m_Batches to be evaluated
+        uint8_t m_Reached{0};        // directions in which findCycle reached the cell, while it runs
+        uint32_t m_Cycle{0};         // key of the cycle (see m_Cycles) the cell lies on, 0 if none
+        uint32_t m_Waiting{0};       // dirty precedents not evaluated yet, during recalculateLevels
+        uint32_t m_Index{0};         // discovery index and lowest index reachable, during splitCycles
+        uint32_t m_LowLink{0};
+        set<CPos> m_Precedents;      // cells this cell refers to
+        set<CPos> m_Dependents;      // cells referring to this cell
+    };
+
+    // Contents of a cell being copied or set: a literal, or the formula if there is none
+    struct CContents {
+        CCellValue m_Literal;
+        CFormula m_Formula;
+    };
+
+    // Evaluation stack entry: a dirty cell and the next of its precedents to visit
+    struct CFrame {
+        CCell *m_Cell;
+        set<CPos>::const_iterator m_Next;
+        bool m_Descended{false};   // a precedent was evaluated by this search
+        bool m_ReadsQueued{false}; // a precedent waits in m_Batches
+    };
+
+    // splitCycles stack entry: a cell and the next of its dependents to visit
+    struct CSearchFrame {
+        CPos m_Pos;
+        CCell *m_Cell;
+        set<CPos>::const_iterator m_Next;
+    };
+
+    // Columns of the operands and results of a batch of kernel formulas (see evaluateBatch)
+    struct CBatch {
+        vector<CCell *> m_Cells;
+        vector<double> m_Lhs;
+        vector<double> m_Rhs;
+        vector<double> m_Out;
+        vector<uint8_t> m_Failed;
+    };
+
+    static constexpr size_t BATCH = 1024; // kernel formulas evaluated by one CColumnKernel call
+    static constexpr size_t MIN_BATCH = 16; // fewer formulas are evaluated one by one
+    static constexpr size_t KERNEL_OPERATORS = (size_t) EOpcode::Ge + 1;
+
+    mutable shared_mutex m_Mutex;      // shared for reading cached values, exclusive otherwise
+    vector<shared_ptr<CArena> > m_Arenas{make_shared<CArena>()}; // hold the instructions of the formulas, new ones go to the last
+    size_t m_LiveCode{0};              // bytes of the own arena in use after the last collection
+    CGrid<CCell> m_Excel;              // formulas and dependency edges of the cells by position
+    CLiteralColumns m_Literals;        // cells holding a number or a string, strings live in m_Strings
+    CParser m_Parser;                  // compiles cell contents, its formula buffer is reused
+    CParseCache m_ParseCache;          // formulas compiled recently, by their normalized text
+    string m_CacheKey;                 // scratch buffer of the normalized text of a formula
+    vector<CPos> m_References;         // scratch buffer of linkPrecedents
+    vector<CFrame> m_Frames;           // scratch stack of evaluate
+    array<vector<CCell *>, KERNEL_OPERATORS> m_Batches; // kernel formulas queued by evaluate, by operator
+    uint32_t m_QueuedOperators{0};     // bit of every operator with a non-empty queue in m_Batches
+    unique_ptr<CThreadPool> m_Pool;    // workers of recalculateLevels, sized by the threads of its last call
+    CJournal m_Journal;                // previous contents of the cells of recent edits, to undo and redo them
+    CShared<vector<CPos> > m_DirtyCells; // cells made dirty since the last recalculation (may be stale)
+    CShared<map<uint32_t, vector<CPos> > > m_Cycles; // cells of every cycle, sorted, by key
+    uint32_t m_NextCycle{1};           // key of the next cycle found
+    shared_ptr<CStringPool> m_Strings{make_shared<CStringPool>()}; // string literals and cached strings, shared by copies
+    size_t m_LiveStrings{0};           // strings in use after the last collection
+
+    // Read cells saved by save() into the (empty) sheet; returns false if input is invalid
+    bool readCells(istream &is) {
         // Read until istream finished || caught error
         string position, tmp;
         int vectorLen, token;
         bool success = true; // flag to know if reading finished
+        CFormula formula;    // buffer reused by all cells, placed into the arena once complete
         while (is >> tmp) {
             // Get position
             if (tmp != "CPos")
                 return false;
             is >> position;
-            CPos pos((string_view(position)));
+            CPos pos(0, 0);
+            if (!parsePos(position, pos))
+                return false;
 
             // Read length of vector
             is >> tmp;
@@ -56,78 +486,41 @@ public:
                 return false;
             is >> vectorLen;
 
-            // Read and save vector of expressions
+            // Read and compile the saved expressions (the cell starts dirty, nothing is cached yet)
+            formula.clear();
             for (int i = 0; i < vectorLen; i++) {
                 is >> token;
+
+                // Operators carry no operand
+                if (token >= (int) EOpcode::Add && token <= (int) EOpcode::Ge) {
+                    formula.pushOperator((EOpcode) token);
+                    continue;
+                }
+
                 switch (token) {
-                    case 0: {
-                        m_Excel[pos].push_back(make_unique<CAdd>());
-                        break;
-                    }
-                    case 1: {
-                        m_Excel[pos].push_back(make_unique<CSub>());
-                        break;
-                    }
-                    case 2: {
-                        m_Excel[pos].push_back(make_unique<CMul>());
-                        break;
-                    }
-                    case 3: {
-                        m_Excel[pos].push_back(make_unique<CDiv>());
-                        break;
-                    }
-                    case 4: {
-                        m_Excel[pos].push_back(make_unique<CPow>());
-                        break;
-                    }
-                    case 5: {
-                        m_Excel[pos].push_back(make_unique<CNeg>());
-                        break;
-                    }
-                    case 6: {
-                        m_Excel[pos].push_back(make_unique<CEq>());
-                        break;
-                    }
-                    case 7: {
-                        m_Excel[pos].push_back(make_unique<CNe>());
-                        break;
-                    }
-                    case 8: {
-                        m_Excel[pos].push_back(make_unique<CLt>());
-                        break;
-                    }
-                    case 9: {
-                        m_Excel[pos].push_back(make_unique<CLe>());
-                        break;
-                    }
-                    case 10: {
-                        m_Excel[pos].push_back(make_unique<CGt>());
-                        break;
-                    }
-                    case 11: {
-                        m_Excel[pos].push_back(make_unique<CGe>());
-                        break;
-                    }
-                    case 12: {
+                    case (int) EOpcode::Number: {
                         double number;
                         is >> number;
-                        m_Excel[pos].push_back(make_unique<CNumber>(number));
+                        formula.pushNumber(number);
                         break;
                     }
-                    case 13: {
+                    case (int) EOpcode::String: {
                         // Read string until met "endOfString"
                         tmp = "";
                         string result;
                         while (is >> tmp && tmp != "endOfString")
                             result += tmp;
 
-                        m_Excel[pos].push_back(make_unique<CString>(result));
+                        formula.pushString(m_Strings->intern(result));
                         break;
                     }
-                    case 14: {
+                    case (int) EOpcode::Reference: {
                         is >> tmp; // "CPos"
                         is >> tmp; // "real" CPos
-                        m_Excel[pos].push_back(make_unique<CReference>(tmp));
+                        CPos reference(0, 0);
+                        if (!parsePos(tmp, reference))
+                            return false;
+                        formula.pushReference(reference);
                         break;
                     }
                     default:
@@ -135,6 +528,16 @@ public:
                 }
             }
 
+            formula.fold(*m_Strings);
+            if (formula.isLiteral()) {
+                m_Excel.erase(pos);
+                m_Literals.set(pos, formula.literal());
+            } else {
+                formula.anchor(pos);
+                m_Literals.erase(pos);
+                m_Excel[pos].m_Formula = formula.placed(arena());
+            }
+
             // Set reading flag
             success = !is.fail();
         }
@@ -143,127 +546,649 @@ public:
         return success;
     }
 
-    // Save spreadsheet to stream
-    bool save(ostream &os) const {
-        for (const auto &pair: m_Excel) {
-            // Save cell if it is not empty
-            int size = (int) pair.second.size();
-            if (size) {
-                // Print position
-                os << pair.first;
+    // Parse a whole saved position without exceptions; returns false if it is invalid
+    static bool parsePos(const string &str, CPos &pos) {
+        const char *end = str.data() + str.size();
+        from_chars_result result = CPos::fromChars(str.data(), end, pos);
+        return result.ec == errc() && result.ptr == end;
+    }
 
-                // Print all expressions
-                os << " VectorLen " << size << " "; // to know how much to read
-                for (const auto &expr: pair.second)
-                    os << expr;
-            }
+    /* Compile the contents of a cell into a literal or a formula placed in the arena, throws
+     * invalid_argument if they are invalid. Contents without '=' are taken as a literal right
+     * away; a formula whose normalized text is cached is moved to pos instead of being parsed,
+     * formulas folding to a literal are not cached. */
+    CContents compile(CPos pos, string_view text) {
+        CContents contents;
+        if (m_Parser.parseLiteral(text, *m_Strings, contents.m_Literal))
+            return contents;
+        bool keyed = m_ParseCache.limit() && m_Parser.normalize(text, pos, m_CacheKey);
+        if (keyed && m_ParseCache.find(m_CacheKey, pos, contents.m_Formula))
+            return contents;
+
+        auto start = chrono::steady_clock::now();
+        m_Parser.parse(text, *m_Strings);
+        CFormula &formula = m_Parser.formula();
+        formula.fold(*m_Strings);
+        auto parseNs = chrono::duration_cast<chrono::nanoseconds>(chrono::steady_clock::now() - start).count();
+        if (formula.isLiteral()) {
+            contents.m_Literal = formula.literal();
+            return contents;
         }
+        formula.anchor(pos);
+        contents.m_Formula = formula.placed(arena());
+        if (keyed)
+            m_ParseCache.insert(m_CacheKey, pos, contents.m_Formula, (uint64_t) parseNs);
+        return contents;
+    }
 
-        return true;
+    // True if the cells of a rectangle of w x h cells at pos lie in the range of CPos
+    static bool inRange(CPos pos, int w, int h) {
+        return w <= 0 || h <= 0
+               || (CPos::inRange((int64_t) pos.getCol() + w - 1) && CPos::inRange((int64_t) pos.getRow() + h - 1));
     }
 
-    // Set contents of a cell (number, string, or expression)
-    bool setCell(CPos pos, const string &contents) {
-        m_ExprBuilder.clearExpressions(); // clear from previous expressions
+    // Contents of a cell: its literal, or its formula if there is none (both empty for an empty cell)
+    CContents contentsOf(CPos pos) const {
+        CContents contents;
+        contents.m_Literal = m_Literals.find(pos);
+        const CCell *cell = as_const(m_Excel).find(pos);
+        if (contents.m_Literal.empty() && cell)
+            contents.m_Formula = cell->m_Formula;
+        return contents;
+    }
 
-        // Create and save vector of all elements (operations, constants, references...)
-        try {
-            parseExpression(contents, m_ExprBuilder);
-        } catch (const exception &e) {
-            cerr << "Error while parsing input: " << e.what();
-            return false;
+    // Cells changed by one edit: the ones to invalidate and, if there is a history, their previous contents
+    struct CChanges {
+        vector<CPos> m_Cells;
+        CJournal::CEdit m_Previous;
+        bool m_Journaled;
+    };
+
+    CChanges beginChanges(size_t cells = 1) {
+        CChanges changes;
+        changes.m_Cells.reserve(cells);
+        changes.m_Journaled = m_Journal.limit() > 0;
+        if (changes.m_Journaled)
+            changes.m_Previous.reserve(cells);
+        return changes;
+    }
+
+    /* Replace contents of a cell by a literal, or by the formula if the literal is empty (both
+     * empty clear the cell), record the previous contents and patch the dependency graph and
+     * the cycles. The cell is not invalidated yet but queued for commitChanges; an empty cell
+     * that never existed is not created. */
+    void storeCell(CPos pos, CCellValue literal, CFormula formula, CChanges &changes) {
+        CContents previous = contentsOf(pos);
+        if (previous.m_Literal.empty() && previous.m_Formula.empty() && literal.empty() && formula.empty())
+            return;
+        if (changes.m_Journaled)
+            changes.m_Previous.push_back({pos, previous.m_Literal, std::move(previous.m_Formula)});
+
+        unlinkPrecedents(pos);
+        CCell *cell;
+        if (!literal.empty() || formula.empty()) {
+            cell = m_Excel.find(pos);
+            if (cell)
+                cell->m_Formula = CFormula();
+            m_Literals.set(pos, literal);
+        } else {
+            m_Literals.erase(pos);
+            cell = &m_Excel[pos];
+            cell->m_Formula = std::move(formula);
+            linkPrecedents(pos);
+        }
+        if (cell) {
+            updateCycles(pos);
+            changes.m_Cells.push_back(pos);
         }
+    }
 
-        m_Excel[pos] = m_ExprBuilder.getExpressions();
-        return true;
+    /* Invalidate the cells queued by storeCell together with their dependents in one search;
+     * a cell edited twice or depending on another edit is visited once. Cells left without
+     * contents and dependents are dropped. The previous contents become the edit to undo. */
+    void commitChanges(CChanges &changes) {
+        invalidateChanges(changes);
+        if (changes.m_Journaled)
+            m_Journal.record(std::move(changes.m_Previous)); // also without changes, every edit is one step
     }
 
-    // Evaluate and return value of a cell; returns empty CValue if undefined or cyclic
-    CValue getValue(CPos pos) {
-        // Check if it is not cycle
-        if (calledPositions.find(pos) != calledPositions.end())
-            return {};
-        calledPositions.insert(pos);
+    void invalidateChanges(CChanges &changes) {
+        vector<CPos> &cells = changes.m_Cells;
+        erase_if(cells, [this](CPos pos) { return !as_const(m_Excel).find(pos); });
+        invalidate(cells);
+        for (const auto &pos: cells) {
+            CCell *cell = m_Excel.find(pos);
+            if (cell && cell->m_Formula.empty())
+                cell->cacheValue({}); // a literal (read from m_Literals) or an empty cell
+            releaseIfUnused(pos);
+        }
+    }
 
-        // Perform all evaluations (result always saved to stack)
-        stack<CValue> values;
-        for (const auto &expr: m_Excel[pos]) {
-            if (!expr->getValue(*this, values)) {
-                calledPositions.clear();
-                return {};
+    /* Give the cells of a recorded edit their recorded contents, last change first, so a cell
+     * changed twice ends with its contents from before the edit. Returns the replaced contents,
+     * the edit restoring them. */
+    CJournal::CEdit restore(CJournal::CEdit edit) {
+        CChanges changes;
+        changes.m_Journaled = true;
+        changes.m_Cells.reserve(edit.size());
+        changes.m_Previous.reserve(edit.size());
+        for (auto it = edit.rbegin(); it != edit.rend(); ++it)
+            storeCell(it->m_Pos, it->m_Literal, std::move(it->m_Formula), changes);
+        invalidateChanges(changes);
+        return std::move(changes.m_Previous);
+    }
+
+    // Register the cell as a dependent of every cell it refers to
+    void linkPrecedents(CPos pos) {
+        CCell &cell = m_Excel[pos];
+        cell.m_Precedents = cell.getReferences(m_References);
+        for (const auto &precedent: cell.m_Precedents)
+            m_Excel[precedent].m_Dependents.insert(pos);
+    }
+
+    // Remove the cell from the dependents of every cell it referred to
+    void unlinkPrecedents(CPos pos) {
+        CCell *cell = m_Excel.find(pos);
+        if (!cell)
+            return;
+
+        set<CPos> precedents = std::move(cell->m_Precedents);
+        cell->m_Precedents.clear();
+        for (const auto &precedent: precedents) {
+            m_Excel[precedent].m_Dependents.erase(pos);
+            if (precedent == pos)
+                continue; // self reference, the cell itself is being edited
+            releaseIfUnused(precedent);
+        }
+    }
+
+    // Drop a cell that has neither contents nor dependents
+    void releaseIfUnused(CPos pos) {
+        const CCell *cell = as_const(m_Excel).find(pos);
+        if (cell && cell->m_Formula.empty() && cell->m_Dependents.empty())
+            m_Excel.erase(pos);
+    }
+
+    /* Mark the cells and their transitive dependents dirty, in one search. A dependent that is
+     * already dirty is not expanded again: everything that read it since it was last evaluated
+     * is dirty too. */
+    void invalidate(span<const CPos> cells) {
+        vector<const CCell *> pending;
+        for (const auto &pos: cells) {
+            CCell &cell = m_Excel[pos];
+            markDirty(pos, cell);
+            pending.push_back(&cell);
+        }
+
+        while (!pending.empty()) {
+            const CCell *current = pending.back();
+            pending.pop_back();
+
+            for (const auto &dependent: current->m_Dependents) {
+                CCell &dependentCell = *m_Excel.find(dependent);
+                if (!dependentCell.m_Dirty) {
+                    markDirty(dependent, dependentCell);
+                    pending.push_back(&dependentCell);
+                }
             }
         }
-        // Delete itself position from called set
-        calledPositions.erase(pos);
+    }
 
-        // Final value
-        if (!values.empty())
-            return values.top();
+    // Mark a cell dirty and queue it for the next recalculation
+    void markDirty(CPos pos, CCell &cell) {
+        if (!cell.m_Dirty)
+            m_DirtyCells.edit().push_back(pos);
+        cell.m_Dirty = true;
 
-        // Empty cell
-        return {};
+        // Cells evaluated on demand stay in the queue; drop them before it outgrows the sheet
+        if (m_DirtyCells->size() > 2 * m_Excel.size() + 16)
+            erase_if(m_DirtyCells.edit(), [this](CPos queued) {
+                const CCell *cell = as_const(m_Excel).find(queued);
+                return !cell || !cell->m_Dirty;
+            });
     }
 
-    // Copy a rectangle of cells to a new position (adjusting references)
-    void copyRect(CPos dst, CPos src, int w = 1, int h = 1) {
-        // Copy selected cells to temporary storage
-        CPos dstCopy = dst;
-        CPos srcCopy = src;
-        map<CPos, vector<AExpr> > newExcel;
+    /* Update the cycles after the references of the cell pos changed. Removed references
+     * may split the cycle pos was on, its cells are decomposed again; added references
+     * may close a new cycle, which runs through pos. Cycles not containing pos stay.
+     * The cells of a dissolved cycle are invalidated: a member evaluated to empty without
+     * reading its precedents, which may have stayed dirty and would not pass it on. */
+    void updateCycles(CPos pos) {
+        CCell &cell = *m_Excel.find(pos);
+        if (cell.m_Cycle) {
+            vector<CPos> cells = std::move(m_Cycles.edit()[cell.m_Cycle]);
+            m_Cycles.edit().erase(cell.m_Cycle);
+            for (const auto &member: cells)
+                m_Excel.find(member)->m_Cycle = 0;
+            invalidate(cells);
+            splitCycles(cells);
+        }
+        findCycle(pos);
+    }
 
-        for (int i = 0; i < w; i++) {
-            // Reset row for each column
-            srcCopy.setRow(src.getRow());
-            dstCopy.setRow(dst.getRow());
+    /* Register the cycle through pos, if there is one: the cells reachable from pos both
+     * through dependents and through precedents. The two directions are searched in turns
+     * and a direction exhausted without meeting pos again proves there is no cycle, so an
+     * edit costs at most twice the smaller of the two searches. */
+    void findCycle(CPos pos) {
+        CCell &cell = *m_Excel.find(pos);
+        if (cell.m_Precedents.empty() || cell.m_Dependents.empty())
+            return;
 
-            for (int j = 0; j < h; j++) {
-                // Copy cell
-                newExcel[dstCopy] = copyExpressions(m_Excel[srcCopy]);
-                srcCopy.setRow(srcCopy.getRow() + 1);
-                dstCopy.setRow(dstCopy.getRow() + 1);
+        vector<pair<CPos, CCell *> > reached{{pos, &cell}};
+        vector<CCell *> pending[2] = {{&cell}, {&cell}}; // 0: through dependents, 1: through precedents
+        bool closed = false;
+        cell.m_Reached = 3;
+        auto step = [&](int direction) {
+            const CCell *current = pending[direction].back();
+            pending[direction].pop_back();
+            for (const auto &next: direction ? current->m_Precedents : current->m_Dependents) {
+                if (next == pos) {
+                    closed = true;
+                    continue;
+                }
+                CCell &nextCell = *m_Excel.find(next);
+                if (nextCell.m_Reached & (1 << direction))
+                    continue;
+                if (!nextCell.m_Reached)
+                    reached.emplace_back(next, &nextCell);
+                nextCell.m_Reached |= 1 << direction;
+                pending[direction].push_back(&nextCell);
             }
+        };
 
-            srcCopy.setCol(srcCopy.getCol() + 1);
-            dstCopy.setCol(dstCopy.getCol() + 1);
+        while (!closed && !pending[0].empty() && !pending[1].empty()) {
+            step(0);
+            step(1);
         }
 
-        // Reset dst column
-        dstCopy.setCol(dst.getCol());
+        // On a cycle, complete both searches; the cycle is where they overlap
+        while (closed && !pending[0].empty())
+            step(0);
+        while (closed && !pending[1].empty())
+            step(1);
+        vector<CPos> cycle;
+        for (const auto &[position, reachedCell]: reached) {
+            if (reachedCell->m_Reached == 3)
+                cycle.push_back(position);
+            reachedCell->m_Reached = 0;
+        }
+        if (closed)
+            addCycle(cycle);
+    }
 
-        // Evaluate offset
-        int colOffset = dst.getCol() - src.getCol();
-        int rowOffset = dst.getRow() - src.getRow();
+    /* Register the cycles among the given cells: the strongly connected components of the
+     * dependency graph restricted to them (Tarjan's algorithm, without recursion) that have
+     * more than one cell or a cell referring to itself. */
+    void splitCycles(const vector<CPos> &cells) {
+        constexpr uint32_t UNVISITED = UINT32_MAX; // m_Index of a given cell not visited yet, 0 outside
 
-        // Write new cells to dst position
-        for (int i = 0; i < w; i++) {
-            // Reset row
-            dstCopy.setRow(dst.getRow());
+        for (const auto &pos: cells)
+            m_Excel.find(pos)->m_Index = UNVISITED;
 
-            for (int j = 0; j < h; j++) {
-                // Change expressions position inside the cell
-                m_Excel[dstCopy] = changePositions(newExcel[dstCopy], colOffset, rowOffset);
-                dstCopy.setRow(dstCopy.getRow() + 1);
+        uint32_t visited = 0;
+        vector<CSearchFrame> frames;
+        vector<CSearchFrame> component; // visited cells whose component is not complete yet
+        auto visit = [&](CPos pos, CCell &cell) {
+            cell.m_Index = cell.m_LowLink = ++visited;
+            frames.push_back({pos, &cell, cell.m_Dependents.begin()});
+            component.push_back(frames.back());
+        };
+
+        for (const auto &root: cells) {
+            CCell &rootCell = *m_Excel.find(root);
+            if (rootCell.m_Index == UNVISITED)
+                visit(root, rootCell);
+
+            while (!frames.empty()) {
+                CSearchFrame &frame = frames.back();
+                CCell &cell = *frame.m_Cell;
+
+                // Descend into the next dependent, or note how low the index of a visited one is
+                if (frame.m_Next != cell.m_Dependents.end()) {
+                    CPos next = *frame.m_Next++;
+                    CCell &nextCell = *m_Excel.find(next);
+                    if (nextCell.m_Index == UNVISITED)
+                        visit(next, nextCell);
+                    else if (nextCell.m_Index)
+                        cell.m_LowLink = min(cell.m_LowLink, nextCell.m_Index);
+                    continue;
+                }
+
+                // The cell is the first one visited of its component, which is now complete
+                if (cell.m_LowLink == cell.m_Index) {
+                    vector<CPos> cycle;
+                    do {
+                        cycle.push_back(component.back().m_Pos);
+                        component.back().m_Cell->m_Index = 0;
+                        component.pop_back();
+                    } while (cycle.back() != frame.m_Pos);
+                    if (cycle.size() > 1 || cell.m_Dependents.count(frame.m_Pos))
+                        addCycle(cycle);
+                }
+
+                uint32_t lowLink = cell.m_LowLink;
+                frames.pop_back();
+                if (!frames.empty())
+                    frames.back().m_Cell->m_LowLink = min(frames.back().m_Cell->m_LowLink, lowLink);
             }
+        }
+    }
 
-            dstCopy.setCol(dstCopy.getCol() + 1);
+    /* Register a cycle, it replaces the cycles found earlier that its cells lay on. Cells
+     * reached through references may carry their absolute flags, the cycle lists plain cells. */
+    void addCycle(vector<CPos> &cells) {
+        uint32_t key = m_NextCycle++;
+        for (auto &pos: cells) {
+            pos = CPos(pos.getCol(), pos.getRow());
+            CCell &cell = *m_Excel.find(pos);
+            if (cell.m_Cycle)
+                m_Cycles.edit().erase(cell.m_Cycle);
+            cell.m_Cycle = key;
         }
+        sort(cells.begin(), cells.end());
+        m_Cycles.edit()[key] = std::move(cells);
     }
 
-private:
-    map<CPos, vector<AExpr> > m_Excel; // maps cell positions to their expressions
-    ExpressionBuilder m_ExprBuilder;   // temporary builder for parsing cell contents
-    set<CPos> calledPositions;         // tracks cells during evaluation to detect cycles
+    /* Evaluate a dirty cell and the dirty cells it depends on without recursion.
+     * Cells are visited depth first with an explicit stack and evaluated in post-order,
+     * so every reference reads an already cached value. Cells on a cycle evaluate to an
+     * empty value without reading anything, cells reading them then fail on the empty
+     * value. The other cells form no cycle, so the search never meets a cell on its stack.
+     * Kernel formulas (see CFormula::isKernel) whose precedents needed no evaluation by the
+     * search are queued by their operator instead, and a queue is evaluated by one
+     * CColumnKernel call once it holds BATCH formulas, e.g. of a column filled with one
+     * formula. A chain of formulas reading each other is evaluated directly. The queues are
+     * flushed before a cell reading a queued one is evaluated, and by the caller after its
+     * last evaluate (see flushBatches). */
+    void evaluate(CCell &root) {
+        if (root.m_Queued)
+            return;
+        if (root.m_Cycle) {
+            root.cacheValue({});
+            return;
+        }
+
+        vector<CFrame> &frames = m_Frames;
+        frames.push_back({&root, root.m_Precedents.begin()});
+        while (!frames.empty()) {
+            CFrame &frame = frames.back();
+            CCell &cell = *frame.m_Cell;
+
+            // Descend into the next dirty precedent
+            if (frame.m_Next != cell.m_Precedents.end()) {
+                CCell *precedent = m_Excel.find(*frame.m_Next++);
+                if (!precedent || !precedent->m_Dirty)
+                    continue;
+
+                if (precedent->m_Queued)
+                    frame.m_ReadsQueued = true;
+                else if (precedent->m_Cycle)
+                    precedent->cacheValue({});
+                else {
+                    frame.m_Descended = true;
+                    frames.push_back({precedent, precedent->m_Precedents.begin()});
+                }
+                continue;
+            }
+
+            // All precedents are evaluated or queued
+            if (frame.m_ReadsQueued)
+                flushBatches();
+            if (!frame.m_Descended && cell.m_Formula.isKernel())
+                queue(cell);
+            else
+                cell.cacheValue(evaluateFormula(cell));
+            frames.pop_back();
+            if (cell.m_Queued && !frames.empty())
+                frames.back().m_ReadsQueued = true;
+        }
+    }
+
+    // Queue a kernel formula for evaluateBatch, a full queue is evaluated right away
+    void queue(CCell &cell) {
+        size_t op = (size_t) cell.m_Formula.kernelOperator();
+        cell.m_Queued = true;
+        m_Batches[op].push_back(&cell);
+        m_QueuedOperators |= 1u << op;
+        if (m_Batches[op].size() == BATCH)
+            flushBatch(op);
+    }
+
+    // Evaluate the queued kernel formulas; they never read each other
+    void flushBatches() {
+        while (m_QueuedOperators)
+            flushBatch((size_t) countr_zero(m_QueuedOperators));
+    }
+
+    void flushBatch(size_t op) {
+        vector<CCell *> &batch = m_Batches[op];
+        for (CCell *cell: batch)
+            cell->m_Queued = false;
+        evaluateBatch(batch.data(), batch.size());
+        batch.clear();
+        m_QueuedOperators &= ~(1u << op);
+    }
+
+    // Evaluate all dirty cells (see recalculate), under the exclusive lock
+    void recalculateDirty(unsigned threads) {
+        if (threads > 1)
+            recalculateLevels(threads);
+        else {
+            for (const auto &pos: *m_DirtyCells) {
+                CCell *cell = m_Excel.find(pos);
+                if (cell && cell->m_Dirty)
+                    evaluate(*cell);
+            }
+            flushBatches();
+        }
+        m_DirtyCells = {};
+        collectStrings();
+    }
+
+    /* Evaluate the dirty cells level by level on the thread pool of the sheet, which is
+     * started by the first call and again only when the number of threads changes. A cell
+     * becomes ready once all its dirty precedents are evaluated (Kahn's algorithm), so the
+     * cells of one level only read cached values of earlier levels and never each other.
+     * Cells on cycles get their empty values first; the others form no cycle and all become
+     * ready. */
+    void recalculateLevels(unsigned threads) {
+        // Collect the distinct dirty cells
+        vector<CCell *> dirty;
+        for (const auto &pos: *m_DirtyCells) {
+            CCell *cell = m_Excel.find(pos);
+            if (!cell || !cell->m_Dirty || cell->m_Collected)
+                continue;
+            if (cell->m_Cycle)
+                cell->cacheValue({});
+            else {
+                cell->m_Collected = true;
+                dirty.push_back(cell);
+            }
+        }
+
+        // Count dirty precedents of every cell, the ones without any form the first level
+        vector<CCell *> level;
+        for (CCell *cell: dirty) {
+            uint32_t count = 0;
+            for (const auto &precedent: cell->m_Precedents) {
+                const CCell *precedentCell = as_const(m_Excel).find(precedent);
+                count += precedentCell && precedentCell->m_Dirty;
+            }
+            cell->m_Waiting = count;
+            cell->m_Collected = false;
+            if (!count)
+                level.push_back(cell);
+        }
+
+        if (!m_Pool || m_Pool->size() != threads)
+            m_Pool = make_unique<CThreadPool>(threads);
+        CThreadPool &pool = *m_Pool;
+        while (!level.empty()) {
+            vector<pair<size_t, size_t> > tasks = splitBatches(level);
+            pool.parallelFor(tasks.size(), [this, &level, &tasks](size_t i) {
+                evaluateBatch(level.data() + tasks[i].first, tasks[i].second - tasks[i].first);
+            });
+
+            // Release dependents whose last dirty precedent was just evaluated
+            vector<CCell *> next;
+            for (const CCell *cell: level)
+                for (const auto &dependent: cell->m_Dependents) {
+                    CCell &dependentCell = *m_Excel.find(dependent);
+                    if (dependentCell.m_Dirty && --dependentCell.m_Waiting == 0)
+                        next.push_back(&dependentCell);
+                }
+            level = std::move(next);
+        }
+    }
+
+    /* Order the cells of a level so that kernel formulas (see CFormula::isKernel) with the same
+     * operator are adjacent, and split them into tasks [begin, end): batches of up to BATCH
+     * such formulas, e.g. a formula copied down a column, and every other cell alone. */
+    static vector<pair<size_t, size_t> > splitBatches(vector<CCell *> &level) {
+        auto batchKey = [](const CCell *cell) {
+            return cell->m_Formula.isKernel() ? (int) cell->m_Formula.kernelOperator() : -1;
+        };
+
+        // Stable counting sort by the key, cells keep the order of their positions in the sheet
+        constexpr int KEYS = (int) EOpcode::Ge + 2;
+        size_t starts[KEYS + 1] = {};
+        for (const CCell *cell: level)
+            starts[batchKey(cell) + 2]++;
+        for (int key = 1; key <= KEYS; key++)
+            starts[key] += starts[key - 1];
+        vector<CCell *> sorted(level.size());
+        for (CCell *cell: level)
+            sorted[starts[batchKey(cell) + 1]++] = cell;
+        level = std::move(sorted);
 
-    // Return a copy of expressions with updated positions
-    static vector<AExpr> changePositions(const vector<AExpr> &expressions, int colOffset, int rowOffset) {
-        vector<AExpr> changedExpressions;
-        changedExpressions.reserve(expressions.size());
+        vector<pair<size_t, size_t> > tasks;
+        for (size_t begin = 0, end; begin < level.size(); begin = end) {
+            int key = batchKey(level[begin]);
+            end = begin + 1;
+            while (key >= 0 && end < level.size() && end - begin < BATCH && batchKey(level[end]) == key)
+                end++;
+            tasks.emplace_back(begin, end);
+        }
+        return tasks;
+    }
+
+    /* Evaluate a task of splitBatches or a queue of evaluate. The number operands of a batch
+     * are gathered into columns and combined by one CColumnKernel call; cells whose operands
+     * are not both numbers are evaluated alone. The cells only read cached values of cells
+     * evaluated before. */
+    void evaluateBatch(CCell **cells, size_t count) {
+        if (count < MIN_BATCH) {
+            for (size_t i = 0; i < count; i++)
+                cells[i]->cacheValue(evaluateFormula(*cells[i]));
+            return;
+        }
 
-        for (const auto &expr: expressions) {
-            changedExpressions.push_back(expr->clone());
-            changedExpressions.back()->changePosition(colOffset, rowOffset);
+        static thread_local CBatch batch;
+        batch.m_Cells.clear();
+        batch.m_Lhs.clear();
+        batch.m_Rhs.clear();
+        for (size_t i = 0; i < count; i++) {
+            const CFormula &formula = cells[i]->m_Formula;
+            double lhs, rhs;
+            if (loadNumber(formula, 0, lhs) && loadNumber(formula, 1, rhs)) {
+                batch.m_Cells.push_back(cells[i]);
+                batch.m_Lhs.push_back(lhs);
+                batch.m_Rhs.push_back(rhs);
+            } else
+                cells[i]->cacheValue(evaluateFormula(*cells[i]));
         }
 
-        return changedExpressions;
+        size_t numbers = batch.m_Cells.size();
+        batch.m_Out.resize(numbers);
+        batch.m_Failed.resize(numbers);
+        CColumnKernel::apply(cells[0]->m_Formula.kernelOperator(), batch.m_Lhs.data(), batch.m_Rhs.data(),
+                             batch.m_Out.data(), batch.m_Failed.data(), numbers);
+        for (size_t i = 0; i < numbers; i++)
+            batch.m_Cells[i]->cacheValue(batch.m_Failed[i] ? CCellValue() : CCellValue(batch.m_Out[i]));
+    }
+
+    // Number operand of a kernel formula: a number literal or a referred cell holding a number
+    bool loadNumber(const CFormula &formula, size_t index, double &number) const {
+        const CInstruction &operand = formula.kernelOperand(index);
+        CCellValue value = operand.m_Op == EOpcode::Reference ? getEvaluatedValue(formula.getPos(operand))
+                                                              : CCellValue(operand.m_Number);
+        if (!value.isNumber())
+            return false;
+        number = value.number();
+        return true;
+    }
+
+    /* Cached value of a cell read by a reference during evaluation. The caller holds the
+     * exclusive lock and evaluates in dependency order, so the cell is already evaluated. */
+    CCellValue getEvaluatedValue(CPos pos) const {
+        CCellValue literal = m_Literals.find(pos);
+        if (!literal.empty())
+            return literal;
+        const CCell *cell = m_Excel.find(pos);
+        return cell ? cell->m_Value : CCellValue();
+    }
+
+    // Run the formula of a cell whose precedents are all evaluated
+    CCellValue evaluateFormula(const CCell &cell) const {
+        return cell.m_Formula.evaluate([this](CPos pos) { return getEvaluatedValue(pos); }, *m_Strings);
+    }
+
+    /* Replace the string pool by one holding only the string literals and the strings of
+     * cached values, once it has grown well past the strings in use. A collection visits
+     * every cell and literal, so at least a fraction of their count must have been interned
+     * since the previous one. Copies of the sheet keep the old pool alive. Values of dirty cells
+     * are dropped. */
+    void collectStrings() {
+        if (m_Strings->size() <= 2 * m_LiveStrings + (m_Excel.size() + m_Literals.size()) / 8 + 1024)
+            return;
+
+        auto strings = make_shared<CStringPool>();
+        CFormula::CMoved moved;
+        CArena &arena = this->arena();
+        m_Excel.forEach([&strings, &arena, &moved](CPos, CCell &cell) {
+            cell.m_Formula.internStrings(*strings, arena, moved);
+            CCellValue &value = cell.m_Value;
+            if (cell.m_Dirty)
+                value = {};
+            else if (value.isString())
+                value = strings->intern(value.str());
+        });
+        m_Literals.internStrings(*strings);
+        m_Journal.internStrings(*strings, arena, moved);
+        m_ParseCache.internStrings(*strings, arena, moved);
+        m_LiveStrings = strings->size();
+        m_Strings = std::move(strings);
+    }
+
+    // Arena receiving the instructions of new formulas
+    CArena &arena() {
+        return *m_Arenas.back();
+    }
+
+    // Keep the arenas of src alive for the shared instructions and allocate into an own new one
+    void shareArenas(const CSpreadsheet &src) {
+        m_Arenas = src.m_Arenas;
+        m_Arenas.push_back(make_shared<CArena>());
+    }
+
+    /* Move the instructions of all formulas into a new arena, once the own arena has grown
+     * well past the instructions in use (edits leave the replaced ones behind). Like
+     * collectStrings, a collection visits every cell, so enough bytes per cell must have
+     * been allocated since the previous one. The old arenas are released with the last
+     * copy of the sheet sharing them. */
+    void collectCode() {
+        if (arena().allocated() <= 2 * m_LiveCode + 8 * m_Excel.size() + (1 << 20))
+            return;
+
+        auto arena = make_shared<CArena>();
+        {
+            CFormula::CMoved moved; // keeps the previous instructions until all formulas moved
+            m_Excel.forEach([&arena, &moved](CPos, CCell &cell) { cell.m_Formula.relocate(*arena, moved); });
+            m_Journal.relocate(*arena, moved);
+            m_ParseCache.relocate(*arena, moved);
+        }
+        m_Arenas = {arena};
+        m_LiveCode = arena->allocated();
     }
 };
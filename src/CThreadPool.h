@@ -0,0 +1,170 @@
+#pragma once
+#include <thread>
+#include <mutex>
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <vector>
+using namespace std;
+
+/* CThreadPool - fixed set of worker threads running parallel loops.
+ * Each loop is split into one contiguous index range per participant (the workers and the
+ * calling thread). A participant takes small chunks from the front of its own range and,
+ * once it is empty, steals the back half of the largest remaining range of another one. */
+class CThreadPool {
+public:
+    explicit CThreadPool(unsigned threads) {
+        if (threads == 0)
+            threads = 1;
+
+        for (unsigned i = 0; i < threads; i++)
+            m_Ranges.push_back(make_unique<CRange>());
+
+        // The calling thread is participant 0
+        for (unsigned i = 1; i < threads; i++)
+            m_Workers.emplace_back([this, i] { work(i); });
+    }
+
+    CThreadPool(const CThreadPool &) = delete;
+    CThreadPool &operator =(const CThreadPool &) = delete;
+
+    ~CThreadPool() {
+        {
+            lock_guard<mutex> lock(m_Mutex);
+            m_Stop = true;
+        }
+        m_Wake.notify_all();
+        for (auto &worker: m_Workers)
+            worker.join();
+    }
+
+    unsigned size() const { return (unsigned) m_Ranges.size(); }
+
+    // Run task(i) for every i in [0, count); returns after all of them finished
+    void parallelFor(size_t count, const function<void(size_t)> &task) {
+        // Split the indices evenly among participants
+        size_t participants = m_Ranges.size();
+        for (size_t i = 0; i < participants; i++) {
+            lock_guard<mutex> lock(m_Ranges[i]->m_Mutex);
+            m_Ranges[i]->m_Begin = count * i / participants;
+            m_Ranges[i]->m_End = count * (i + 1) / participants;
+        }
+
+        {
+            lock_guard<mutex> lock(m_Mutex);
+            m_Task = &task;
+            m_Busy = (unsigned) m_Workers.size();
+            m_Generation++;
+        }
+        m_Wake.notify_all();
+
+        runTask(0);
+
+        // Wait for the workers to drain everything
+        unique_lock<mutex> lock(m_Mutex);
+        m_Done.wait(lock, [this] { return m_Busy == 0; });
+        m_Task = nullptr;
+    }
+
+private:
+    // Indices [m_Begin, m_End) still to be processed by one participant
+    struct CRange {
+        mutex m_Mutex;
+        size_t m_Begin{0};
+        size_t m_End{0};
+    };
+
+    static constexpr size_t CHUNK = 16; // indices taken from the own range at once
+
+    vector<thread> m_Workers;
+    vector<unique_ptr<CRange> > m_Ranges;
+    mutex m_Mutex;
+    condition_variable m_Wake;             // signals a new loop or shutdown to the workers
+    condition_variable m_Done;             // signals the caller that all workers finished
+    const function<void(size_t)> *m_Task{nullptr};
+    size_t m_Generation{0};                // number of loops started so far
+    unsigned m_Busy{0};                    // workers still running the current loop
+    bool m_Stop{false};
+
+    // Worker thread main loop
+    void work(unsigned self) {
+        size_t seen = 0;
+        while (true) {
+            {
+                unique_lock<mutex> lock(m_Mutex);
+                m_Wake.wait(lock, [this, seen] { return m_Stop || m_Generation != seen; });
+                if (m_Stop)
+                    return;
+                seen = m_Generation;
+            }
+
+            runTask(self);
+
+            lock_guard<mutex> lock(m_Mutex);
+            if (--m_Busy == 0)
+                m_Done.notify_one();
+        }
+    }
+
+    // Process the own range, then help the others until nothing is left
+    void runTask(unsigned self) {
+        size_t begin, end;
+        while (take(self, begin, end) || steal(self, begin, end))
+            for (size_t i = begin; i < end; i++)
+                (*m_Task)(i);
+    }
+
+    // Take a chunk from the front of the own range
+    bool take(unsigned self, size_t &begin, size_t &end) {
+        CRange &range = *m_Ranges[self];
+        lock_guard<mutex> lock(range.m_Mutex);
+        if (range.m_Begin == range.m_End)
+            return false;
+
+        begin = range.m_Begin;
+        end = min(range.m_End, begin + CHUNK);
+        range.m_Begin = end;
+        return true;
+    }
+
+    // Move the back half of the largest other range into the own one and take a chunk of it
+    bool steal(unsigned self, size_t &begin, size_t &end) {
+        while (true) {
+            // Pick a victim; the sizes may change right after they are read
+            unsigned victim = self;
+            size_t largest = 0;
+            for (unsigned i = 0; i < m_Ranges.size(); i++) {
+                if (i == self)
+                    continue;
+                lock_guard<mutex> lock(m_Ranges[i]->m_Mutex);
+                size_t remaining = m_Ranges[i]->m_End - m_Ranges[i]->m_Begin;
+                if (remaining > largest) {
+                    largest = remaining;
+                    victim = i;
+                }
+            }
+            if (victim == self)
+                return false;
+
+            size_t stolenBegin, stolenEnd;
+            {
+                CRange &range = *m_Ranges[victim];
+                lock_guard<mutex> lock(range.m_Mutex);
+                size_t remaining = range.m_End - range.m_Begin;
+                if (remaining == 0)
+                    continue; // emptied in the meantime, look again
+                stolenEnd = range.m_End;
+                stolenBegin = range.m_End - (remaining + 1) / 2;
+                range.m_End = stolenBegin;
+            }
+
+            {
+                lock_guard<mutex> lock(m_Ranges[self]->m_Mutex);
+                m_Ranges[self]->m_Begin = stolenBegin;
+                m_Ranges[self]->m_End = stolenEnd;
+            }
+            if (take(self, begin, end))
+                return true;
+        }
+    }
+};
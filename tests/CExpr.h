@@ -1,5 +1,5 @@
 #pragma once
-#include <stack>
+#include "../src/CCellValue.h"
 #include <memory>
 #include <variant>
 #include <string>
@@ -7,13 +7,11 @@
 
 using namespace std;
 
-// Cell value type: empty, number, or string
-using CValue = variant<monostate, double, string>;
-
 // Pointer to an expression node
 using AExpr = unique_ptr<class CExpr>;
 
 class CSpreadsheet;
+class CPos;
 
 /* CExpr - abstract base class for all spreadsheet expressions (numbers, strings, operators, references).
  * Supports evaluation, cloning, and printing. */
@@ -22,8 +20,9 @@ public:
     virtual ~CExpr() = default;
 
     virtual AExpr clone() const = 0;                            // Deep copy
-    virtual bool getValue(CSpreadsheet & sheet, stack<CValue> & values) const = 0;
+    virtual bool getValue(CSpreadsheet & sheet, vector<CValue> & values) const = 0;
     virtual void changePosition(int colOffset, int rowOffset) {} // only for references
+    virtual void getReferences(vector<CPos> &references) const {} // only for references
     virtual void print(ostream & os) const = 0;
 
     friend ostream & operator << (ostream & os, const AExpr & expression) {
@@ -1,18 +1,21 @@
 #pragma once
 #include "CExpr.h"
-#include "CPos.h"
+#include "../src/CSpreadsheet.h"
+#include "../src/CPos.h"
 #include <string>
-#include <stack>
 #include <cmath>
 
-/* Helper function: Pop two top values from the stack for binary operations.
- * Returns them as a pair {lhs, rhs}. */
-inline pair<CValue, CValue> getTwoTopValues(stack<CValue> &values) {
-    CValue rhs = values.top();
-    values.pop();
-    CValue lhs = values.top();
-    values.pop();
-    return make_pair(lhs, rhs);
+/* Expression nodes evaluated one virtual call per node, as the sheet did before formulas were
+ * compiled into CFormula instructions. Kept with the tests as the reference implementation
+ * the compiled formulas are checked against, and used by the benchmarks as their baseline. */
+
+/* Helper function: Pop the right operand of a binary operation.
+ * Returns {lhs, rhs}: lhs stays on top of the stack and receives the result in place,
+ * rhs is moved off the stack. */
+inline pair<CValue &, CValue> getTwoTopValues(vector<CValue> &values) {
+    CValue rhs = std::move(values.back());
+    values.pop_back();
+    return {values.back(), std::move(rhs)};
 }
 
 /* Binary arithmetic expressions
@@ -27,7 +30,7 @@ public:
         return unique_ptr<CAdd>(newExpr);
     }
 
-    bool getValue(CSpreadsheet &sheet, stack<CValue> &values) const override {
+    bool getValue(CSpreadsheet &sheet, vector<CValue> &values) const override {
         if (values.size() < 2) return false;
 
         // Pop the two top values from the stack
@@ -35,27 +38,20 @@ public:
 
         // Case 1: both are numbers → perform addition
         if (holds_alternative<double>(lhs) && holds_alternative<double>(rhs)) {
-            double left = get<double>(lhs);
-            double right = get<double>(rhs);
-            values.emplace(left + right);
+            lhs = get<double>(lhs) + get<double>(rhs);
             return true;
         }
 
         // Case 2: concatenate if both are non-empty (string + string, string + number, number + string)
         if (!holds_alternative<monostate>(lhs) && !holds_alternative<monostate>(rhs)) {
-            auto doubleToStr = [](double val) -> string {
-                string s = to_string(val);
-                // Remove trailing zeros and dot
-                s.erase(s.find_last_not_of('0') + 1, string::npos);
-                if (!s.empty() && s.back() == '.') s.pop_back();
-                return s;
-            };
-
-            string left = holds_alternative<double>(lhs) ? doubleToStr(get<double>(lhs)) : get<string>(lhs);
-            string right = holds_alternative<double>(rhs) ? doubleToStr(get<double>(rhs)) : get<string>(rhs);
-
-            // Concatenate strings
-            values.emplace(left + right);
+            if (holds_alternative<double>(lhs))
+                lhs = numberToString(get<double>(lhs));
+
+            // Append to the left string in place
+            if (holds_alternative<double>(rhs))
+                get<string>(lhs) += numberToString(get<double>(rhs));
+            else
+                get<string>(lhs) += get<string>(rhs);
             return true;
         }
 
@@ -75,7 +71,7 @@ public:
         return unique_ptr<CSub>(newExpr);
     }
 
-    bool getValue(CSpreadsheet &sheet, stack<CValue> &values) const override {
+    bool getValue(CSpreadsheet &sheet, vector<CValue> &values) const override {
         if (values.size() >= 2) {
             // Get two values from top of the stack
             auto [lhs, rhs] = getTwoTopValues(values);
@@ -84,7 +80,7 @@ public:
             if (holds_alternative<double>(lhs) && holds_alternative<double>(rhs)) {
                 double left = get<double>(lhs);
                 double right = get<double>(rhs);
-                values.emplace(left - right);
+                lhs = left - right;
                 return true;
             }
         }
@@ -105,7 +101,7 @@ public:
         return unique_ptr<CMul>(newExpr);
     }
 
-    bool getValue(CSpreadsheet &sheet, stack<CValue> &values) const override {
+    bool getValue(CSpreadsheet &sheet, vector<CValue> &values) const override {
         if (values.size() >= 2) {
             // Get two values from top of the stack
             auto [lhs, rhs] = getTwoTopValues(values);
@@ -114,7 +110,7 @@ public:
             if (holds_alternative<double>(lhs) && holds_alternative<double>(rhs)) {
                 double left = get<double>(lhs);
                 double right = get<double>(rhs);
-                values.emplace(left * right);
+                lhs = left * right;
                 return true;
             }
         }
@@ -135,7 +131,7 @@ public:
         return unique_ptr<CDiv>(newExpr);
     }
 
-    bool getValue(CSpreadsheet &sheet, stack<CValue> &values) const override {
+    bool getValue(CSpreadsheet &sheet, vector<CValue> &values) const override {
         if (values.size() >= 2) {
             // Get two values from top of the stack
             auto [lhs, rhs] = getTwoTopValues(values);
@@ -147,7 +143,7 @@ public:
 
                 // Check if right isn't zero
                 if (right != 0) {
-                    values.emplace(left / right);
+                    lhs = left / right;
                     return true;
                 }
             }
@@ -169,7 +165,7 @@ public:
         return unique_ptr<CPow>(newExpr);
     }
 
-    bool getValue(CSpreadsheet &sheet, stack<CValue> &values) const override {
+    bool getValue(CSpreadsheet &sheet, vector<CValue> &values) const override {
         if (values.size() >= 2) {
             // Get two values from top of the stack
             auto [lhs, rhs] = getTwoTopValues(values);
@@ -178,7 +174,7 @@ public:
             if (holds_alternative<double>(lhs) && holds_alternative<double>(rhs)) {
                 double left = get<double>(lhs);
                 double right = get<double>(rhs);
-                values.emplace(pow(left, right));
+                lhs = pow(left, right);
                 return true;
             }
         }
@@ -199,15 +195,13 @@ public:
         return unique_ptr<CNeg>(newExpr);
     }
 
-    bool getValue(CSpreadsheet &sheet, stack<CValue> &values) const override {
+    bool getValue(CSpreadsheet &sheet, vector<CValue> &values) const override {
         if (!values.empty()) {
-            CValue operand = values.top();
-            values.pop();
+            CValue &operand = values.back();
 
-            // Check if the operand is double
+            // Check if the operand is double (negated in place)
             if (holds_alternative<double>(operand)) {
-                double val = get<double>(operand);
-                values.emplace(-val);
+                operand = -get<double>(operand);
                 return true;
             }
         }
@@ -231,7 +225,7 @@ public:
         return unique_ptr<CEq>(newExpr);
     }
 
-    bool getValue(CSpreadsheet &sheet, stack<CValue> &values) const override {
+    bool getValue(CSpreadsheet &sheet, vector<CValue> &values) const override {
         // Check if there are at least two values on the stack
         if (values.size() >= 2) {
             auto [lhs, rhs] = getTwoTopValues(values);
@@ -239,14 +233,14 @@ public:
             // Two doubles
             if (holds_alternative<double>(lhs) && holds_alternative<double>(rhs)) {
                 double res = get<double>(lhs) == get<double>(rhs);
-                values.emplace(res);
+                lhs = res;
                 return true;
             }
 
             // Two strings
             if (holds_alternative<string>(lhs) && holds_alternative<string>(rhs)) {
                 double res = get<string>(lhs) == get<string>(rhs);
-                values.emplace(res);
+                lhs = res;
                 return true;
             }
         }
@@ -267,7 +261,7 @@ public:
         return unique_ptr<CNe>(newExpr);
     }
 
-    bool getValue(CSpreadsheet &sheet, stack<CValue> &values) const override {
+    bool getValue(CSpreadsheet &sheet, vector<CValue> &values) const override {
         // Check if there are at least two values on the stack
         if (values.size() >= 2) {
             auto [lhs, rhs] = getTwoTopValues(values);
@@ -275,14 +269,14 @@ public:
             // Two doubles
             if (holds_alternative<double>(lhs) && holds_alternative<double>(rhs)) {
                 double res = get<double>(lhs) != get<double>(rhs);
-                values.emplace(res);
+                lhs = res;
                 return true;
             }
 
             // Two strings
             if (holds_alternative<string>(lhs) && holds_alternative<string>(rhs)) {
                 double res = get<string>(lhs) != get<string>(rhs);
-                values.emplace(res);
+                lhs = res;
                 return true;
             }
         }
@@ -303,7 +297,7 @@ public:
         return unique_ptr<CLt>(newExpr);
     }
 
-    bool getValue(CSpreadsheet &sheet, stack<CValue> &values) const override {
+    bool getValue(CSpreadsheet &sheet, vector<CValue> &values) const override {
         // Check if there are at least two values on the stack
         if (values.size() >= 2) {
             auto [lhs, rhs] = getTwoTopValues(values);
@@ -311,14 +305,14 @@ public:
             // Two doubles
             if (holds_alternative<double>(lhs) && holds_alternative<double>(rhs)) {
                 double res = get<double>(lhs) < get<double>(rhs);
-                values.emplace(res);
+                lhs = res;
                 return true;
             }
 
             // Two strings
             if (holds_alternative<string>(lhs) && holds_alternative<string>(rhs)) {
                 double res = get<string>(lhs) < get<string>(rhs);
-                values.emplace(res);
+                lhs = res;
                 return true;
             }
         }
@@ -339,7 +333,7 @@ public:
         return unique_ptr<CLe>(newExpr);
     }
 
-    bool getValue(CSpreadsheet &sheet, stack<CValue> &values) const override {
+    bool getValue(CSpreadsheet &sheet, vector<CValue> &values) const override {
         // Check if there are at least two values on the stack
         if (values.size() >= 2) {
             auto [lhs, rhs] = getTwoTopValues(values);
@@ -347,14 +341,14 @@ public:
             // Two doubles
             if (holds_alternative<double>(lhs) && holds_alternative<double>(rhs)) {
                 double res = get<double>(lhs) <= get<double>(rhs);
-                values.emplace(res);
+                lhs = res;
                 return true;
             }
 
             // Two strings
             if (holds_alternative<string>(lhs) && holds_alternative<string>(rhs)) {
                 double res = get<string>(lhs) <= get<string>(rhs);
-                values.emplace(res);
+                lhs = res;
                 return true;
             }
         }
@@ -375,7 +369,7 @@ public:
         return unique_ptr<CGt>(newExpr);
     }
 
-    bool getValue(CSpreadsheet &sheet, stack<CValue> &values) const override {
+    bool getValue(CSpreadsheet &sheet, vector<CValue> &values) const override {
         // Check if there are at least two values on the stack
         if (values.size() >= 2) {
             auto [lhs, rhs] = getTwoTopValues(values);
@@ -383,14 +377,14 @@ public:
             // Two doubles
             if (holds_alternative<double>(lhs) && holds_alternative<double>(rhs)) {
                 double res = get<double>(lhs) > get<double>(rhs);
-                values.emplace(res);
+                lhs = res;
                 return true;
             }
 
             // Two strings
             if (holds_alternative<string>(lhs) && holds_alternative<string>(rhs)) {
                 double res = get<string>(lhs) > get<string>(rhs);
-                values.emplace(res);
+                lhs = res;
                 return true;
             }
         }
@@ -411,7 +405,7 @@ public:
         return unique_ptr<CGe>(newExpr);
     }
 
-    bool getValue(CSpreadsheet &sheet, stack<CValue> &values) const override {
+    bool getValue(CSpreadsheet &sheet, vector<CValue> &values) const override {
         // Check if there are at least two values on the stack
         if (values.size() >= 2) {
             auto [lhs, rhs] = getTwoTopValues(values);
@@ -419,14 +413,14 @@ public:
             // Two doubles
             if (holds_alternative<double>(lhs) && holds_alternative<double>(rhs)) {
                 double res = get<double>(lhs) >= get<double>(rhs);
-                values.emplace(res);
+                lhs = res;
                 return true;
             }
 
             // Two strings
             if (holds_alternative<string>(lhs) && holds_alternative<string>(rhs)) {
                 double res = get<string>(lhs) >= get<string>(rhs);
-                values.emplace(res);
+                lhs = res;
                 return true;
             }
         }
@@ -451,8 +445,8 @@ public:
         return unique_ptr<CNumber>(newExpr);
     }
 
-    bool getValue(CSpreadsheet &sheet, stack<CValue> &values) const override {
-        values.emplace(m_Number);
+    bool getValue(CSpreadsheet &sheet, vector<CValue> &values) const override {
+        values.emplace_back(m_Number);
         return true;
     }
 
@@ -474,8 +468,8 @@ public:
         return unique_ptr<CString>(newExpr);
     }
 
-    bool getValue(CSpreadsheet &sheet, stack<CValue> &values) const override {
-        values.emplace(m_String);
+    bool getValue(CSpreadsheet &sheet, vector<CValue> &values) const override {
+        values.emplace_back(m_String);
         return true;
     }
 
@@ -500,12 +494,22 @@ public:
         return unique_ptr<CReference>(newExpr);
     }
 
-    bool getValue(CSpreadsheet &sheet, stack<CValue> &values) const override;
+    bool getValue(CSpreadsheet &sheet, vector<CValue> &values) const override {
+        CValue value = sheet.getValue(m_Pos);
+        if (holds_alternative<monostate>(value))
+            return false;
+        values.push_back(std::move(value));
+        return true;
+    }
 
     void changePosition(int colOffset, int rowOffset) override {
         m_Pos.changePosition(colOffset, rowOffset);
     }
 
+    void getReferences(vector<CPos> &references) const override {
+        references.push_back(m_Pos);
+    }
+
     void print(ostream &os) const override {
         os << " 14 " << m_Pos;
     }
@@ -1,11 +1,27 @@
 #include "TestCPos.h"
 #include "TestCExprNodes.h"
+#include "TestCFormula.h"
+#include "TestCParser.h"
+#include "TestCParseCache.h"
+#include "TestCCellValue.h"
+#include "TestCColumnKernel.h"
+#include "TestCGrid.h"
+#include "TestCLiteralColumns.h"
+#include "TestCJournal.h"
 #include "TestCSpreadsheet.h"
 
 int main() {
     // Unit tests for src classes
     TestCPos();
     TestCExprNodes();
+    TestCFormula();
+    TestCParser();
+    TestCParseCache();
+    TestCCellValue();
+    TestCColumnKernel();
+    TestCGrid();
+    TestCLiteralColumns();
+    TestCJournal();
     TestCSpreadsheet();
     return EXIT_SUCCESS;
 }
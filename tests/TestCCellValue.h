@@ -0,0 +1,49 @@
+#pragma once
+#include "../src/CCellValue.h"
+#include <cassert>
+#include <string>
+
+using namespace std;
+
+class TestCCellValue {
+public:
+    TestCCellValue() {
+        testConversions();
+        testInterning();
+    }
+
+private:
+    static void testConversions() {
+        CStringPool pool;
+
+        CCellValue empty;
+        assert(empty.empty());
+        assert(holds_alternative<monostate>(empty.toValue()));
+
+        CCellValue number = CCellValue::fromValue(-2.5, pool);
+        assert(number.isNumber() && number.number() == -2.5);
+        assert(get<double>(number.toValue()) == -2.5);
+
+        CCellValue str = CCellValue::fromValue(string("a longer text than the small string buffer"), pool);
+        assert(str.isString());
+        assert(get<string>(str.toValue()) == "a longer text than the small string buffer");
+
+        assert(CCellValue::fromValue(CValue(), pool).empty());
+    }
+
+    // Equal strings are stored once and keep their address
+    static void testInterning() {
+        CStringPool pool;
+        const string *first = pool.intern("text");
+        for (int i = 0; i < 1000; i++)
+            pool.intern(to_string(i));
+
+        assert(pool.intern(string("te") + "xt") == first);
+        assert(*first == "text");
+        assert(pool.size() == 1001);
+
+        CCellValue a = CCellValue::fromValue(string("text"), pool);
+        CCellValue b = a;
+        assert(&a.str() == first && &b.str() == first);
+    }
+};
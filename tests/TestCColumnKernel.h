@@ -0,0 +1,61 @@
+#pragma once
+#include "../src/CColumnKernel.h"
+#include <cassert>
+#include <cmath>
+#include <cstring>
+#include <limits>
+#include <random>
+#include <vector>
+
+using namespace std;
+
+class TestCColumnKernel {
+public:
+    TestCColumnKernel() {
+        testMatchesScalar();
+    }
+
+private:
+    // Every instruction set gives bit for bit the results of applyNumbers
+    static void testMatchesScalar() {
+        vector<double> special{0.0, -0.0, 1.0, -2.5, 3.0, 1e308, -1e-310, numeric_limits<double>::infinity(),
+                               -numeric_limits<double>::infinity(), numeric_limits<double>::quiet_NaN()};
+        mt19937 random(42);
+        uniform_real_distribution<double> numbers(-100, 100);
+
+        // All pairs of special values, then random ones (also an odd count for the remainder loops)
+        vector<double> lhs, rhs;
+        for (double l: special)
+            for (double r: special) {
+                lhs.push_back(l);
+                rhs.push_back(r);
+            }
+        for (int i = 0; i < 203; i++) {
+            lhs.push_back(numbers(random));
+            rhs.push_back(i % 7 ? numbers(random) : 0.0);
+        }
+
+        size_t count = lhs.size();
+        vector<double> out(count), expected(count);
+        vector<uint8_t> failed(count), expectedFailed(count);
+        for (int op = (int) EOpcode::Add; op <= (int) EOpcode::Ge; op++) {
+            if ((EOpcode) op == EOpcode::Neg)
+                continue;
+            CColumnKernel::apply((EOpcode) op, lhs.data(), rhs.data(), expected.data(), expectedFailed.data(), count,
+                                 CColumnKernel::EInstructionSet::Scalar);
+
+            for (int set = 0; set <= (int) CColumnKernel::best(); set++) {
+                CColumnKernel::apply((EOpcode) op, lhs.data(), rhs.data(), out.data(), failed.data(), count,
+                                     (CColumnKernel::EInstructionSet) set);
+                for (size_t i = 0; i < count; i++) {
+                    assert(failed[i] == expectedFailed[i]);
+                    assert(failed[i] || memcmp(&out[i], &expected[i], sizeof(double)) == 0);
+                }
+            }
+
+            // The scalar path is applyNumbers itself
+            for (size_t i = 0; i < count; i++)
+                assert(expectedFailed[i] == ((EOpcode) op == EOpcode::Div && rhs[i] == 0));
+        }
+    }
+};
@@ -1,7 +1,6 @@
 #pragma once
-#include "../src/CExprNodes.h"
+#include "CExprNodes.h"
 #include <cassert>
-#include <stack>
 #include <string>
 
 using namespace std;
@@ -13,11 +12,12 @@ public:
         testStrings();
         testArithmetic();
         testComparisons();
+        testConcatenation();
     }
 
 private:
     static void testNumbers() {
-        stack<CValue> values;
+        vector<CValue> values;
         CNumber n1(5);
         CNumber n2(3.5);
 
@@ -25,14 +25,14 @@ private:
         n2.getValue(*(CSpreadsheet *) nullptr, values);
 
         assert(values.size() == 2);
-        assert(get<double>(values.top()) == 3.5);
-        values.pop();
-        assert(get<double>(values.top()) == 5);
-        values.pop();
+        assert(get<double>(values.back()) == 3.5);
+        values.pop_back();
+        assert(get<double>(values.back()) == 5);
+        values.pop_back();
     }
 
     static void testStrings() {
-        stack<CValue> values;
+        vector<CValue> values;
         CString s1("Hello");
         CString s2("World");
 
@@ -40,97 +40,109 @@ private:
         s2.getValue(*(CSpreadsheet *) nullptr, values);
 
         assert(values.size() == 2);
-        assert(get<string>(values.top()) == "World");
-        values.pop();
-        assert(get<string>(values.top()) == "Hello");
-        values.pop();
+        assert(get<string>(values.back()) == "World");
+        values.pop_back();
+        assert(get<string>(values.back()) == "Hello");
+        values.pop_back();
     }
 
     static void testArithmetic() {
-        stack<CValue> values;
+        vector<CValue> values;
 
-        values.emplace(2.0);
-        values.emplace(3.0);
+        values.emplace_back(2.0);
+        values.emplace_back(3.0);
 
         CAdd add;
         assert(add.getValue(*(CSpreadsheet*)nullptr, values));
         assert(values.size() == 1);
-        assert(get<double>(values.top()) == 5.0);
-        values.pop();
+        assert(get<double>(values.back()) == 5.0);
+        values.pop_back();
 
-        values.emplace(10.0);
-        values.emplace(4.0);
+        values.emplace_back(10.0);
+        values.emplace_back(4.0);
 
         CSub sub;
         assert(sub.getValue(*(CSpreadsheet*)nullptr, values));
-        assert(get<double>(values.top()) == 6.0);
-        values.pop();
+        assert(get<double>(values.back()) == 6.0);
+        values.pop_back();
 
-        values.emplace(2.0);
-        values.emplace(3.0);
+        values.emplace_back(2.0);
+        values.emplace_back(3.0);
 
         CMul mul;
         assert(mul.getValue(*(CSpreadsheet*)nullptr, values));
-        assert(get<double>(values.top()) == 6.0);
-        values.pop();
+        assert(get<double>(values.back()) == 6.0);
+        values.pop_back();
 
-        values.emplace(10.0);
-        values.emplace(2.0);
+        values.emplace_back(10.0);
+        values.emplace_back(2.0);
 
         CDiv div;
         assert(div.getValue(*(CSpreadsheet*)nullptr, values));
-        assert(get<double>(values.top()) == 5.0);
-        values.pop();
+        assert(get<double>(values.back()) == 5.0);
+        values.pop_back();
 
-        values.emplace(2.0);
-        values.emplace(3.0);
+        values.emplace_back(2.0);
+        values.emplace_back(3.0);
 
         CPow pow;
         assert(pow.getValue(*(CSpreadsheet*)nullptr, values));
-        assert(get<double>(values.top()) == 8.0);
-        values.pop();
+        assert(get<double>(values.back()) == 8.0);
+        values.pop_back();
 
-        values.emplace(5.0);
+        values.emplace_back(5.0);
 
         CNeg neg;
         assert(neg.getValue(*(CSpreadsheet*)nullptr, values));
-        assert(get<double>(values.top()) == -5.0);
-        values.pop();
+        assert(get<double>(values.back()) == -5.0);
+        values.pop_back();
+    }
+
+    // Concatenation of a string with a number appends to the left operand
+    static void testConcatenation() {
+        vector<CValue> values;
+        values.emplace_back(string("abc"));
+        values.emplace_back(1.5);
+
+        CAdd add;
+        assert(add.getValue(*(CSpreadsheet*)nullptr, values));
+        assert(values.size() == 1);
+        assert(get<string>(values.back()) == "abc1.5");
     }
 
     static void testComparisons() {
-        stack<CValue> values;
+        vector<CValue> values;
 
         // Equality
-        values.emplace(2.0);
-        values.emplace(2.0);
+        values.emplace_back(2.0);
+        values.emplace_back(2.0);
         CEq eq;
         assert(eq.getValue(*(CSpreadsheet*)nullptr, values));
-        assert(get<double>(values.top()) == 1);
-        values.pop();
+        assert(get<double>(values.back()) == 1);
+        values.pop_back();
 
         // Inequality
-        values.emplace(2.0);
-        values.emplace(3.0);
+        values.emplace_back(2.0);
+        values.emplace_back(3.0);
         CNe ne;
         assert(ne.getValue(*(CSpreadsheet*)nullptr, values));
-        assert(get<double>(values.top()) == 1);
-        values.pop();
+        assert(get<double>(values.back()) == 1);
+        values.pop_back();
 
         // Less than
-        values.emplace(2.0);
-        values.emplace(3.0);
+        values.emplace_back(2.0);
+        values.emplace_back(3.0);
         CLt lt;
         assert(lt.getValue(*(CSpreadsheet*)nullptr, values));
-        assert(get<double>(values.top()) == 1);
-        values.pop();
+        assert(get<double>(values.back()) == 1);
+        values.pop_back();
 
         // Greater or equal
-        values.emplace(3.0);
-        values.emplace(3.0);
+        values.emplace_back(3.0);
+        values.emplace_back(3.0);
         CGe ge;
         assert(ge.getValue(*(CSpreadsheet*)nullptr, values));
-        assert(get<double>(values.top()) == 1);
-        values.pop();
+        assert(get<double>(values.back()) == 1);
+        values.pop_back();
     }
 };
@@ -0,0 +1,402 @@
+#pragma once
+#include "../src/CFormula.h"
+#include "../src/CArena.h"
+#include "CExprNodes.h"
+#include "../src/CParser.h"
+#include <cassert>
+#include <map>
+#include <sstream>
+#include <string>
+
+using namespace std;
+
+class TestCFormula {
+public:
+    TestCFormula() {
+        testEvaluation();
+        testMatchesNodes();
+        testReferences();
+        testInvalidFormulas();
+        testInternedStrings();
+        testFold();
+        testSharedCode();
+        testArena();
+        testPrint();
+    }
+
+private:
+    static CStringPool &strings() {
+        static CStringPool pool;
+        return pool;
+    }
+
+    // Evaluate a formula without references
+    static CValue evaluate(const CFormula &formula) {
+        return formula.evaluate([](CPos) -> const CValue & {
+            static const CValue empty;
+            return empty;
+        });
+    }
+
+    // Exact comparison where NaN equals NaN
+    static bool sameValue(const CValue &a, const CValue &b) {
+        if (holds_alternative<double>(a) && holds_alternative<double>(b) && isnan(get<double>(a)))
+            return isnan(get<double>(b));
+        return a == b;
+    }
+
+    static void testEvaluation() {
+        // 1 + 2 * 3
+        CFormula formula;
+        formula.pushNumber(1);
+        formula.pushNumber(2);
+        formula.pushNumber(3);
+        formula.pushOperator(EOpcode::Mul);
+        formula.pushOperator(EOpcode::Add);
+        assert(formula.size() == 5);
+        assert(formula.maxDepth() == 3);
+        assert(get<double>(evaluate(formula)) == 7);
+
+        // -"a" is not defined
+        CFormula neg;
+        neg.pushString(strings().intern("a"));
+        neg.pushOperator(EOpcode::Neg);
+        assert(holds_alternative<monostate>(evaluate(neg)));
+
+        // Empty formula
+        assert(holds_alternative<monostate>(evaluate(CFormula())));
+    }
+
+    // Every operator gives the same result as the corresponding CExpr node
+    static void testMatchesNodes() {
+        vector<CValue> operands{0.0, 2.0, -3.5, 1e300, string("abc"), string("abd"), string("")};
+        vector<pair<EOpcode, AExpr> > operators;
+        operators.emplace_back(EOpcode::Add, make_unique<CAdd>());
+        operators.emplace_back(EOpcode::Sub, make_unique<CSub>());
+        operators.emplace_back(EOpcode::Mul, make_unique<CMul>());
+        operators.emplace_back(EOpcode::Div, make_unique<CDiv>());
+        operators.emplace_back(EOpcode::Pow, make_unique<CPow>());
+        operators.emplace_back(EOpcode::Eq, make_unique<CEq>());
+        operators.emplace_back(EOpcode::Ne, make_unique<CNe>());
+        operators.emplace_back(EOpcode::Lt, make_unique<CLt>());
+        operators.emplace_back(EOpcode::Le, make_unique<CLe>());
+        operators.emplace_back(EOpcode::Gt, make_unique<CGt>());
+        operators.emplace_back(EOpcode::Ge, make_unique<CGe>());
+
+        auto push = [](CFormula &formula, const CValue &value) {
+            if (holds_alternative<double>(value))
+                formula.pushNumber(get<double>(value));
+            else
+                formula.pushString(strings().intern(get<string>(value)));
+        };
+
+        CSpreadsheet sheet; // the operator nodes read no cells
+        for (const auto &[op, node]: operators)
+            for (const auto &lhs: operands)
+                for (const auto &rhs: operands) {
+                    vector<CValue> values;
+                    values.push_back(lhs);
+                    values.push_back(rhs);
+                    CValue expected = node->getValue(sheet, values) ? values.back() : CValue();
+
+                    CFormula formula;
+                    push(formula, lhs);
+                    push(formula, rhs);
+                    formula.pushOperator(op);
+                    assert(sameValue(evaluate(formula), expected));
+
+                    // Shapes with references run by the specialized kernels
+                    map<CPos, CValue> cells{{CPos("A1"), lhs}, {CPos("B1"), rhs}};
+                    auto readCell = [&cells](CPos pos) -> const CValue & { return cells[pos]; };
+                    auto readCached = [&cells](CPos pos) { return CCellValue::fromValue(cells[pos], strings()); };
+                    vector<CFormula> shapes(3);
+                    shapes[0].pushReference(CPos("A1"));
+                    shapes[0].pushReference(CPos("B1"));
+                    shapes[1].pushReference(CPos("A1"));
+                    push(shapes[1], rhs);
+                    push(shapes[2], lhs);
+                    shapes[2].pushReference(CPos("B1"));
+                    for (auto &shape: shapes) {
+                        shape.pushOperator(op);
+                        assert(sameValue(shape.evaluate(readCell), expected));
+                        assert(sameValue(shape.evaluate(readCached, strings()).toValue(), expected));
+                    }
+                }
+
+        // An empty referred cell makes the kernels fail like the nodes
+        CFormula shape;
+        shape.pushReference(CPos("A1"));
+        shape.pushNumber(1);
+        shape.pushOperator(EOpcode::Sub);
+        assert(holds_alternative<monostate>(evaluate(shape)));
+    }
+
+    static void testReferences() {
+        map<CPos, CValue> cells{{CPos("A1"), 4.0}, {CPos("B2"), string("x")}};
+        auto readCell = [&cells](CPos pos) -> const CValue & {
+            static const CValue empty;
+            auto it = cells.find(pos);
+            return it == cells.end() ? empty : it->second;
+        };
+
+        // $A1 ^ 2
+        CFormula formula;
+        formula.pushReference(CPos("$A1"));
+        formula.pushNumber(2);
+        formula.pushOperator(EOpcode::Pow);
+        assert(get<double>(formula.evaluate(readCell)) == 16);
+
+        // Moving keeps the absolute column
+        formula.changePosition(1, 1);
+        vector<CPos> references;
+        formula.getReferences(references);
+        assert(references.size() == 1);
+        assert(references[0].getCol() == 0 && references[0].getRow() == 2 && references[0].isAbsCol());
+
+        // Reading an empty cell makes the formula empty
+        assert(holds_alternative<monostate>(formula.evaluate(readCell)));
+
+        CFormula concat;
+        concat.pushReference(CPos("B2"));
+        concat.pushReference(CPos("A1"));
+        concat.pushOperator(EOpcode::Add);
+        assert(get<string>(concat.evaluate(readCell)) == "x4");
+    }
+
+    // Operators without operands make the formula empty
+    static void testInvalidFormulas() {
+        CFormula missing;
+        missing.pushNumber(1);
+        missing.pushOperator(EOpcode::Add);
+        assert(holds_alternative<monostate>(evaluate(missing)));
+
+        CFormula neg;
+        neg.pushOperator(EOpcode::Neg);
+        assert(holds_alternative<monostate>(evaluate(neg)));
+    }
+
+    // Literals and cached values interned in one pool compare by address, others by contents
+    static void testInternedStrings() {
+        CStringPool pool;
+        map<CPos, CCellValue> cached{{CPos("A1"), pool.intern("ok")}, {CPos("A2"), pool.intern("no")}};
+        auto readCached = [&cached](CPos pos) { return cached.at(pos); };
+        map<CPos, CValue> plain{{CPos("A1"), string("ok")}, {CPos("A2"), string("no")}};
+        auto readPlain = [&plain](CPos pos) -> const CValue & { return plain.at(pos); };
+
+        for (const char *name: {"A1", "A2"}) {
+            // name == "ok", name < "ok"
+            for (EOpcode op: {EOpcode::Eq, EOpcode::Lt}) {
+                CFormula formula;
+                formula.pushReference(CPos(name));
+                formula.pushString(pool.intern("ok"));
+                formula.pushOperator(op);
+
+                double expected = op == EOpcode::Eq ? string(name) == "A1" : string(name) == "A2";
+                assert(get<double>(formula.evaluate(readCached)) == expected);
+                assert(get<double>(formula.evaluate(readPlain)) == expected);
+            }
+        }
+
+        // Strings built by the formula are interned into the pool of the cached value
+        CFormula concat;
+        concat.pushReference(CPos("A1"));
+        concat.pushString(pool.intern("!"));
+        concat.pushOperator(EOpcode::Add);
+        CCellValue value = concat.evaluate(readCached, pool);
+        assert(value.isString() && &value.str() == pool.intern("ok!"));
+
+        // An interned result is cached without a copy
+        CFormula literal;
+        literal.pushString(pool.intern("no"));
+        assert(&literal.evaluate(readCached, pool).str() == &cached[CPos("A2")].str());
+    }
+
+    // Folded formulas evaluate exactly like the original ones, whatever A1 holds
+    static void testFold() {
+        vector<pair<string, size_t> > formulas{
+            {"=2^10*3+A1", 3},
+            {"=A1*1", 3},               // A1 may be a string
+            {"=(A1-1)*1", 3},
+            {"=1*(A1/2)/1^1", 3},
+            {"=-(-(A1*2))", 3},
+            {"=-(-A1)", 3},             // A1 may be a string
+            {"=(A1-0)+0", 5},           // x+0 turns -0 into 0
+            {"=A1-(0-0)", 3},
+            {"=\"ab\"+\"c\"=A1", 3},
+            {"=1/0+A1", 5},             // fails when evaluated, kept
+            {"=\"a\"*2+A1", 5},
+            {"=-\"a\"", 2},
+            {"=1/3", 3},                // 0.333333 would be saved inexactly
+            {"=2^2000", 3},             // inf cannot be loaded
+            {"=1+2*\"x\"", 5}};
+        vector<CValue> values{CValue(), 0.0, -0.0, 2.0, -1e300, 0.0 / 0.0, string("abc"), string("")};
+
+        CParser parser;
+        auto pool = make_shared<CStringPool>();
+        for (const auto &[text, size]: formulas) {
+            parser.parse(text, *pool);
+            CFormula original = parser.takeFormula();
+            CFormula folded = original;
+            assert(folded.fold(*pool) == original.size() - size);
+            assert(folded.size() == size);
+
+            for (const auto &value: values) {
+                auto readCell = [&value](CPos) -> const CValue & { return value; };
+                CValue expected = original.evaluate(readCell);
+                CValue result = folded.evaluate(readCell);
+                assert(sameValue(result, expected));
+                if (holds_alternative<double>(expected))
+                    assert(signbit(get<double>(result)) == signbit(get<double>(expected)));
+            }
+        }
+    }
+
+    // Copies share the instructions, moving a copy or anchoring it keeps the referred cells
+    static void testSharedCode() {
+        // B2 * $A$1 + C$1, built in B3
+        auto build = [](int row) {
+            CFormula formula;
+            formula.pushReference(CPos(1, row - 1));
+            formula.pushReference(CPos("$A$1"));
+            formula.pushOperator(EOpcode::Mul);
+            formula.pushReference(CPos("C$1"));
+            formula.pushOperator(EOpcode::Add);
+            formula.anchor(CPos(1, row));
+            return formula;
+        };
+        auto references = [](const CFormula &formula) {
+            vector<CPos> positions;
+            formula.getReferences(positions);
+            ostringstream os;
+            for (const auto &pos: positions)
+                os << pos;
+            return os.str();
+        };
+
+        CFormula formula = build(3);
+        assert(references(formula) == " CPos B2 CPos $A$1 CPos C$1");
+
+        CFormula copy = formula;
+        copy.changePosition(2, 5);
+        assert(copy.sharesCode(formula));
+        assert(references(copy) == " CPos D7 CPos $A$1 CPos E$1");
+        assert(references(formula) == " CPos B2 CPos $A$1 CPos C$1");
+
+        // The same formula typed two rows lower prints like the moved copy
+        CFormula typed = build(5);
+        CFormula moved = formula;
+        moved.changePosition(0, 2);
+        ostringstream typedText, movedText;
+        typedText << typed;
+        movedText << moved;
+        assert(typedText.str() == movedText.str());
+
+        // Moves taking the cell or a referred one out of the range of CPos are refused
+        CArena bounds;
+        for (const CFormula &placed: {formula, formula.placed(bounds)}) {
+            assert(placed.canMove(CPos::MAX - 2, 0) && !placed.canMove(CPos::MAX - 1, 0));
+            assert(placed.canMove(0, CPos::MIN - 2) && !placed.canMove(0, CPos::MIN - 3));
+        }
+        CFormula refused = formula;
+        try {
+            refused.changePosition(CPos::MAX - 1, 0);
+            assert(false && "Expected exception not thrown");
+        } catch (const invalid_argument &) {
+            assert(references(refused) == " CPos B2 CPos $A$1 CPos C$1");
+        }
+
+        // Extending a copy leaves the shared instructions alone
+        copy.pushNumber(1);
+        copy.pushOperator(EOpcode::Sub);
+        assert(!copy.sharesCode(formula) && formula.size() == 5 && copy.size() == 7);
+
+        // Strings moved into a new pool stay shared by the copies
+        CArena arena; // outlives the formulas placed in it
+        CStringPool pool;
+        CFormula text;
+        text.pushString(strings().intern("abc"));
+        CFormula textCopy = text;
+        CFormula::CMoved relocated;
+        text.internStrings(pool, arena, relocated);
+        textCopy.internStrings(pool, arena, relocated);
+        assert(text.sharesCode(textCopy) && get<string>(evaluate(text)) == "abc");
+        assert(arena.allocated() > 0);
+    }
+
+    // Formulas placed into an arena keep their meaning, the builder buffer is reused
+    static void testArena() {
+        CArena arena, other; // outlive the formulas placed in them
+        CFormula buffer;
+        buffer.pushReference(CPos("A1"));
+        buffer.pushNumber(2);
+        buffer.pushOperator(EOpcode::Mul);
+        buffer.anchor(CPos("B1"));
+
+        CFormula placed = buffer.placed(arena);
+        size_t allocated = arena.allocated();
+        assert(allocated >= 3 * sizeof(CInstruction) && !placed.sharesCode(buffer));
+        ostringstream bufferText, placedText;
+        bufferText << buffer;
+        placedText << placed;
+        assert(bufferText.str() == placedText.str() && placed.isKernel());
+
+        // Copies and moves of a placed formula share its instructions, relocation keeps the sharing
+        CFormula copy = placed;
+        copy.changePosition(0, 1);
+        CFormula::CMoved moved;
+        placed.relocate(other, moved);
+        copy.relocate(other, moved);
+        assert(copy.sharesCode(placed) && arena.allocated() == allocated);
+        vector<CPos> references;
+        copy.getReferences(references);
+        assert(references.size() == 1 && !(references[0] < CPos("A2")) && !(CPos("A2") < references[0]));
+
+        // Clearing keeps the buffer, a shared one is let go
+        buffer.clear();
+        assert(buffer.empty() && !buffer.isKernel());
+        buffer.pushNumber(1);
+        assert(buffer.isLiteral() && buffer.literal().number() == 1);
+        CFormula shared = placed;
+        placed.clear();
+        assert(placed.empty() && shared.size() == 3);
+    }
+
+    // Printed formulas are identical to the printed CExpr nodes
+    static void testPrint() {
+        vector<AExpr> nodes;
+        nodes.push_back(make_unique<CReference>("$B3"));
+        nodes.push_back(make_unique<CNumber>(2.5));
+        nodes.push_back(make_unique<CString>("text"));
+        nodes.push_back(make_unique<CAdd>());
+        nodes.push_back(make_unique<CGe>());
+        nodes.push_back(make_unique<CNeg>());
+
+        CFormula formula;
+        formula.pushReference(CPos("$B3"));
+        formula.pushNumber(2.5);
+        formula.pushString(strings().intern("text"));
+        formula.pushOperator(EOpcode::Add);
+        formula.pushOperator(EOpcode::Ge);
+        formula.pushOperator(EOpcode::Neg);
+
+        ostringstream expected, printed;
+        for (const auto &node: nodes)
+            expected << node;
+        printed << formula;
+        assert(printed.str() == expected.str());
+
+        // Literals print as their one-instruction formulas
+        for (const CCellValue &value: {CCellValue(2.5), CCellValue(strings().intern("some text"))}) {
+            CFormula literal;
+            if (value.isNumber())
+                literal.pushNumber(value.number());
+            else
+                literal.pushString(&value.str());
+            assert(literal.isLiteral() && !formula.isLiteral());
+            ostringstream printedFormula, printedLiteral;
+            printedFormula << literal;
+            CFormula::printLiteral(printedLiteral, literal.literal());
+            assert(printedLiteral.str() == printedFormula.str());
+        }
+    }
+};
@@ -0,0 +1,118 @@
+#pragma once
+#include "../src/CGrid.h"
+#include <cassert>
+#include <utility>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class TestCGrid {
+public:
+    TestCGrid() {
+        testAccess();
+        testMatchesMap();
+        testOrder();
+        testCopy();
+    }
+
+private:
+    static bool samePos(CPos a, CPos b) {
+        return a.getCol() == b.getCol() && a.getRow() == b.getRow();
+    }
+
+    static void testAccess() {
+        CGrid<string> grid;
+        assert(grid.empty() && !grid.find(CPos("A1")));
+
+        grid[CPos("A1")] = "a";
+        grid[CPos("BB700")] = "b";
+        grid[CPos(-1, -70)] = "negative"; // references may point above or left of the sheet
+        assert(grid.size() == 3 && grid.tiles() == 3);
+        assert(*grid.find(CPos("A1")) == "a");
+        assert(*grid.find(CPos(-1, -70)) == "negative");
+        assert(!grid.find(CPos("A2")) && !grid.find(CPos(-1, -69)));
+
+        // Values do not move when others are inserted
+        string *value = grid.find(CPos("A1"));
+        for (int row = 2; row < 2000; row++)
+            grid[CPos(0, row)] = to_string(row);
+        assert(value == grid.find(CPos("A1")) && *value == "a");
+
+        // Erasing releases the value, a tile without values is dropped
+        assert(grid.erase(CPos("BB700")) && !grid.erase(CPos("BB700")));
+        assert(!grid.find(CPos("BB700")) && grid.size() == 2000);
+        assert(grid[CPos("BB701")].empty());
+        grid.clear();
+        assert(grid.empty() && grid.tiles() == 0 && !grid.find(CPos("A1")));
+    }
+
+    // Random inserts and erases give the same contents as a map
+    static void testMatchesMap() {
+        CGrid<int> grid;
+        map<CPos, int> expected;
+        mt19937 random(3);
+        for (int i = 0; i < 100000; i++) {
+            CPos pos((int) (random() % 300) - 20, (int) (random() % 300) - 20);
+            if (random() % 3 == 0) {
+                assert(grid.erase(pos) == (expected.erase(pos) == 1));
+            } else {
+                grid[pos] = i;
+                expected[pos] = i;
+            }
+        }
+
+        assert(grid.size() == expected.size());
+        size_t visited = 0;
+        grid.forEach([&](CPos pos, int value) {
+            assert(expected.at(pos) == value);
+            visited++;
+        });
+        assert(visited == expected.size());
+    }
+
+    // Cells are visited by tiles, then by columns, whatever the order of insertion
+    static void testOrder() {
+        vector<CPos> positions{CPos(0, 1), CPos(0, 63), CPos(1, 0), CPos(0, 64), CPos(64, 0), CPos(-64, 5)};
+        vector<CPos> expected{CPos(-64, 5), CPos(0, 1), CPos(0, 63), CPos(1, 0), CPos(0, 64), CPos(64, 0)};
+        for (int round = 0; round < 2; round++) {
+            CGrid<int> grid;
+            for (const auto &pos: positions)
+                grid[pos] = 1;
+
+            vector<CPos> visited;
+            grid.forEach([&visited](CPos pos, int) { visited.push_back(pos); });
+            assert(equal(visited.begin(), visited.end(), expected.begin(), expected.end(), samePos));
+            reverse(positions.begin(), positions.end());
+        }
+    }
+
+    // Copies are independent of the original
+    static void testCopy() {
+        CGrid<vector<int> > grid;
+        grid[CPos("C3")] = {1, 2};
+        CGrid<vector<int> > copy(grid);
+        copy[CPos("C3")].push_back(3);
+        copy[CPos("D4")] = {4};
+        assert(grid.size() == 1 && grid.find(CPos("C3"))->size() == 2);
+        assert(copy.size() == 2 && copy.find(CPos("C3"))->size() == 3);
+
+        grid = copy;
+        copy.clear();
+        assert(grid.size() == 2 && grid.find(CPos("D4"))->front() == 4);
+
+        // A copy shares the tiles until either side changes one of them
+        CGrid<int> large;
+        for (int col = 0; col < 256; col++)
+            large[CPos(col, col)] = col;
+        CGrid<int> snapshot(large);
+        assert(snapshot.sharedTiles(large) == 4);
+        large[CPos(0, 0)] = -1;
+        snapshot.erase(CPos(255, 255));
+        assert(snapshot.sharedTiles(large) == 2);
+        assert(*snapshot.find(CPos(0, 0)) == 0 && *large.find(CPos(255, 255)) == 255);
+        assert(*as_const(snapshot).find(CPos(100, 100)) == 100 && snapshot.sharedTiles(large) == 2);
+    }
+};
@@ -0,0 +1,107 @@
+#pragma once
+#include "../src/CJournal.h"
+#include "../src/CArena.h"
+#include <cassert>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class TestCJournal {
+public:
+    TestCJournal() {
+        testUndoRedo();
+        testLimit();
+        testInternStrings();
+    }
+
+private:
+    static CJournal::CEdit edit(int row, double number) {
+        CJournal::CEdit changes;
+        changes.push_back({CPos(0, row), CCellValue(number), CFormula()});
+        return changes;
+    }
+
+    static void testUndoRedo() {
+        CJournal journal;
+        assert(journal.empty() && !journal.canUndo() && !journal.canRedo() && journal.bytes() == 0);
+
+        journal.record(edit(1, 1));
+        journal.record(edit(2, 2));
+        CJournal::CEdit last = journal.takeUndo();
+        assert(last.size() == 1 && last[0].m_Pos.getRow() == 2 && last[0].m_Literal.number() == 2);
+        journal.undone(edit(2, 20));
+        assert(journal.canUndo() && journal.canRedo());
+
+        // Redoing records the contents to undo again, the redo history stays
+        assert(journal.takeUndo()[0].m_Literal.number() == 1 && !journal.canUndo());
+        journal.undone(edit(1, 10));
+        CJournal::CEdit redo = journal.takeRedo();
+        assert(redo[0].m_Literal.number() == 10);
+        journal.redone(edit(1, 1));
+        assert(journal.takeRedo()[0].m_Literal.number() == 20);
+
+        // A new edit forgets what could be redone
+        journal.undone(edit(2, 20));
+        journal.record(edit(3, 3));
+        assert(!journal.canRedo() && journal.takeUndo()[0].m_Literal.number() == 3);
+        assert(journal.takeUndo()[0].m_Literal.number() == 1 && !journal.canUndo());
+        assert(journal.bytes() == 0);
+    }
+
+    static void testLimit() {
+        size_t one = sizeof(CJournal::CEdit) + sizeof(CJournal::CChange);
+        CJournal journal(3 * one);
+        for (int row = 0; row < 5; row++)
+            journal.record(edit(row, row));
+        assert(journal.bytes() == 3 * one);
+
+        // The oldest edits are forgotten first
+        assert(journal.takeUndo()[0].m_Pos.getRow() == 4);
+        journal.undone(edit(4, 4));
+        journal.setLimit(2 * one);
+        assert(journal.canRedo() && journal.takeUndo()[0].m_Pos.getRow() == 3 && !journal.canUndo());
+
+        // An edit over the limit is not kept, no limit keeps nothing
+        CJournal::CEdit large;
+        for (int row = 0; row < 10; row++)
+            large.push_back({CPos(1, row), CCellValue(), CFormula()});
+        journal.record(std::move(large));
+        assert(journal.empty() && journal.bytes() == 0);
+        journal.setLimit(0);
+        journal.record(edit(1, 1));
+        assert(journal.empty());
+
+        // The instructions of a recorded formula count as well, shared with a cell or not
+        CArena arena;
+        CFormula formula;
+        formula.pushNumber(1);
+        formula.pushNumber(2);
+        formula.pushOperator(EOpcode::Add);
+        CJournal::CEdit changes;
+        changes.push_back({CPos(0, 1), CCellValue(), formula.placed(arena)});
+        journal.setLimit(one + 3 * sizeof(CInstruction));
+        journal.record(std::move(changes));
+        assert(journal.canUndo() && journal.bytes() == one + 3 * sizeof(CInstruction));
+        journal.setLimit(one + 2 * sizeof(CInstruction));
+        assert(journal.empty());
+    }
+
+    static void testInternStrings() {
+        CStringPool pool, other;
+        CArena arena;
+        CJournal journal;
+        CFormula formula;
+        formula.pushString(pool.intern("formula"));
+        CJournal::CEdit changes;
+        changes.push_back({CPos(0, 1), CCellValue(pool.intern("literal")), CFormula()});
+        changes.push_back({CPos(0, 2), CCellValue(), formula.placed(arena)});
+        journal.record(std::move(changes));
+
+        CFormula::CMoved moved;
+        journal.internStrings(other, arena, moved);
+        CJournal::CEdit restored = journal.takeUndo();
+        assert(&restored[0].m_Literal.str() == other.intern("literal"));
+        assert(restored[1].m_Formula.literal().isString() && &restored[1].m_Formula.literal().str() == other.intern("formula"));
+    }
+};
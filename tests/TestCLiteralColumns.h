@@ -0,0 +1,132 @@
+#pragma once
+#include "../src/CLiteralColumns.h"
+#include "../src/CGrid.h"
+#include <cassert>
+#include <map>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class TestCLiteralColumns {
+public:
+    TestCLiteralColumns() {
+        testAccess();
+        testMatchesMap();
+        testCopy();
+        testInternStrings();
+    }
+
+private:
+    static bool sameValue(const CCellValue &a, const CCellValue &b) {
+        if (a.isNumber())
+            return b.isNumber() && a.number() == b.number();
+        if (a.isString())
+            return b.isString() && &a.str() == &b.str();
+        return b.empty();
+    }
+
+    static void testAccess() {
+        CStringPool pool;
+        CLiteralColumns literals;
+        assert(literals.size() == 0 && literals.find(CPos("A1")).empty());
+
+        literals.set(CPos("A1"), 42.0);
+        literals.set(CPos("A2"), pool.intern("text"));
+        literals.set(CPos(-3, -100), -1.5);
+        assert(literals.size() == 3);
+        assert(literals.find(CPos("A1")).number() == 42);
+        assert(&literals.find(CPos("A2")).str() == pool.intern("text"));
+        assert(literals.find(CPos(-3, -100)).number() == -1.5);
+        assert(literals.find(CPos("A3")).empty() && literals.find(CPos("B1")).empty());
+
+        // A number replaces a string in the same row and the other way round
+        literals.set(CPos("A2"), 7.0);
+        literals.set(CPos("A1"), pool.intern("other"));
+        assert(literals.size() == 3);
+        assert(literals.find(CPos("A2")).number() == 7);
+        assert(literals.find(CPos("A1")).str() == "other");
+
+        // Erasing, also by setting an empty value
+        assert(literals.erase(CPos("A1")) && !literals.erase(CPos("A1")));
+        literals.set(CPos("A2"), CCellValue());
+        assert(literals.size() == 1 && literals.find(CPos("A2")).empty());
+        literals.clear();
+        assert(literals.size() == 0 && literals.find(CPos(-3, -100)).empty());
+    }
+
+    // Random sets and erases give the same contents as a map, visited in the order of CGrid
+    static void testMatchesMap() {
+        CStringPool pool;
+        CLiteralColumns literals;
+        map<CPos, CCellValue> expected;
+        mt19937 random(5);
+        for (int i = 0; i < 100000; i++) {
+            CPos pos((int) (random() % 200) - 20, (int) (random() % 200) - 20);
+            switch (random() % 4) {
+                case 0:
+                    assert(literals.erase(pos) == (expected.erase(pos) == 1));
+                    break;
+                case 1:
+                    literals.set(pos, pool.intern(to_string(i % 50)));
+                    expected[pos] = pool.intern(to_string(i % 50));
+                    break;
+                default:
+                    literals.set(pos, (double) i);
+                    expected[pos] = (double) i;
+            }
+        }
+
+        assert(literals.size() == expected.size());
+        vector<CPos> visited;
+        literals.forEach([&](CPos pos, CCellValue value) {
+            assert(sameValue(expected.at(pos), value));
+            visited.push_back(pos);
+        });
+        assert(visited.size() == expected.size());
+
+        CGrid<int> grid;
+        for (const auto &pair: expected)
+            grid[pair.first] = 0;
+        size_t i = 0;
+        grid.forEach([&](CPos pos, int) {
+            assert(!(pos < visited[i]) && !(visited[i] < pos));
+            i++;
+        });
+    }
+
+    // A copy is independent of the original
+    static void testCopy() {
+        CStringPool pool;
+        CLiteralColumns literals;
+        for (int row = 0; row < 300; row++)
+            literals.set(CPos(1, row), row % 2 ? CCellValue((double) row) : CCellValue(pool.intern("even")));
+
+        CLiteralColumns copy(literals);
+        copy.set(CPos(1, 1), pool.intern("odd"));
+        copy.erase(CPos(1, 2));
+        assert(literals.find(CPos(1, 1)).number() == 1);
+        assert(literals.find(CPos(1, 2)).str() == "even");
+        assert(copy.find(CPos(1, 1)).str() == "odd" && copy.find(CPos(1, 2)).empty());
+
+        literals = copy;
+        assert(literals.size() == 299 && literals.find(CPos(1, 1)).str() == "odd");
+        CLiteralColumns moved(std::move(copy));
+        assert(moved.size() == 299 && moved.find(CPos(1, 299)).number() == 299);
+    }
+
+    static void testInternStrings() {
+        CStringPool pool;
+        CLiteralColumns literals;
+        literals.set(CPos("A1"), pool.intern("a"));
+        literals.set(CPos("A2"), 2.0);
+        literals.set(CPos("B70"), pool.intern("b"));
+
+        CStringPool other;
+        literals.internStrings(other);
+        assert(&literals.find(CPos("A1")).str() == other.intern("a"));
+        assert(&literals.find(CPos("B70")).str() == other.intern("b"));
+        assert(literals.find(CPos("A2")).number() == 2 && other.size() == 2);
+    }
+};
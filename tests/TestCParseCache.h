@@ -0,0 +1,99 @@
+#pragma once
+#include "../src/CParseCache.h"
+#include "../src/CParser.h"
+#include "../src/CArena.h"
+#include <cassert>
+#include <string>
+
+using namespace std;
+
+class TestCParseCache {
+public:
+    TestCParseCache() {
+        testLookup();
+        testLimit();
+        testRelocate();
+    }
+
+private:
+    // Formula of the contents placed in host, the way CSpreadsheet compiles it
+    static CFormula compile(CParser &parser, CStringPool &strings, CArena &arena, const string &contents, CPos host) {
+        parser.parse(contents, strings);
+        CFormula &formula = parser.formula();
+        formula.fold(strings);
+        formula.anchor(host);
+        return formula.placed(arena);
+    }
+
+    // A hit is the cached formula moved to the new cell, sharing its instructions
+    static void testLookup() {
+        CParser parser;
+        CStringPool strings;
+        CArena arena;
+        CParseCache cache;
+        string key;
+
+        assert(parser.normalize("=B2*C2+$A$1", CPos("A2"), key));
+        CFormula found;
+        assert(!cache.find(key, CPos("A2"), found));
+        CFormula formula = compile(parser, strings, arena, "=B2*C2+$A$1", CPos("A2"));
+        cache.insert(key, CPos("A2"), formula, 1000);
+        assert(cache.size() == 1);
+
+        assert(parser.normalize("=B7*C7+$A$1", CPos("A7"), key));
+        assert(cache.find(key, CPos("A7"), found));
+        assert(found.sharesCode(formula));
+        auto value = [](CPos pos) { return CValue((double) (pos.getCol() * 100 + pos.getRow())); };
+        assert(found.evaluate(value) == CValue(107.0 * 207 + 1)); // B7*C7+A1
+
+        // A key already cached keeps its entry
+        cache.insert(key, CPos("A7"), found, 500);
+        const CParseCache::CStats &stats = cache.stats();
+        assert(cache.size() == 1 && stats.m_Hits == 1 && stats.m_Misses == 1);
+        assert(stats.m_ParseNs == 1500 && stats.hitRate() == 0.5);
+
+        // The hit saved the average miss, less its own time
+        assert(stats.savedNs() == (stats.m_HitNs < 1500 ? 1500 - stats.m_HitNs : 0));
+        assert(CParseCache::CStats().savedNs() == 0);
+    }
+
+    // The least recently used formula is forgotten first, 0 caches nothing
+    static void testLimit() {
+        CParser parser;
+        CStringPool strings;
+        CArena arena;
+        CParseCache cache(2);
+        CFormula found;
+        cache.insert("a", CPos("B1"), compile(parser, strings, arena, "=A1", CPos("B1")), 0);
+        cache.insert("b", CPos("B1"), compile(parser, strings, arena, "=A1+1", CPos("B1")), 0);
+        assert(cache.find("a", CPos("B1"), found));
+        cache.insert("c", CPos("B1"), compile(parser, strings, arena, "=A1+2", CPos("B1")), 0);
+        assert(cache.size() == 2 && cache.limit() == 2);
+        assert(!cache.find("b", CPos("B1"), found) && cache.find("a", CPos("B1"), found) && cache.find("c", CPos("B1"), found));
+
+        cache.setLimit(1);
+        assert(cache.size() == 1 && cache.find("c", CPos("B1"), found));
+        cache.setLimit(0);
+        cache.insert("a", CPos("B1"), compile(parser, strings, arena, "=A1", CPos("B1")), 0);
+        assert(cache.size() == 0 && !cache.find("a", CPos("B1"), found));
+        cache.clear();
+        assert(cache.stats().m_Hits == 4 && cache.stats().m_Misses == 2);
+    }
+
+    // Cached formulas follow the sheet into new arenas and string pools
+    static void testRelocate() {
+        CParser parser;
+        CStringPool strings, pool;
+        CArena arena, moved; // outlive the formulas placed in them
+        CParseCache cache;
+        cache.insert("key", CPos("A1"), compile(parser, strings, arena, "=\"x\"+B1", CPos("A1")), 0);
+
+        CFormula::CMoved relocated, interned;
+        cache.relocate(moved, relocated);
+        cache.internStrings(pool, moved, interned);
+        assert(pool.size() == 1);
+        CFormula found;
+        assert(cache.find("key", CPos("A2"), found));
+        assert(found.evaluate([](CPos pos) { return pos.getCol() == 1 && pos.getRow() == 2 ? CValue(string("y")) : CValue(); }) == CValue(string("xy")));
+    }
+};
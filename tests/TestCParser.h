@@ -0,0 +1,171 @@
+#pragma once
+#include "../src/CParser.h"
+#include <bit>
+#include <cassert>
+#include <cmath>
+#include <random>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+using namespace std;
+
+class TestCParser {
+public:
+    TestCParser() {
+        testGrammar();
+        testErrors();
+        testDepth();
+        testNormalize();
+        testLiterals();
+    }
+
+private:
+    // Instructions of the compiled contents in the format of save(), numbers printed exactly
+    static string compile(CParser &parser, CStringPool &strings, const string &contents) {
+        parser.parse(contents, strings);
+        ostringstream os;
+        os.precision(17);
+        os << parser.formula();
+        return os.str();
+    }
+
+    // Expected instructions are the ones parseExpression emits through ExpressionBuilder
+    static void testGrammar() {
+        vector<pair<string, string> > cases{
+            {"=1+2*3", " 12 1  12 2  12 3  2  0 "},
+            {"=1-2-3", " 12 1  12 2  1  12 3  1 "},
+            {"=2^3^2", " 12 2  12 3  4  12 2  4 "},
+            {"=-2^2", " 12 2  12 2  4  5 "},
+            {"=2*-3^2", " 12 2  12 3  12 2  4  5  2 "},
+            {"=--2", " 12 2  5  5 "},
+            {"=-(-1)", " 12 1  5  5 "},
+            {"=(1+2)*3", " 12 1  12 2  0  12 3  2 "},
+            {"= 1 +\t2 ", " 12 1  12 2  0 "},
+            {"=1<>2<=3>=4", " 12 1  12 2  12 3  9  12 4  11  7 "},
+            {"=1=2<3", " 12 1  12 2  12 3  8  6 "},
+            {"=1<2=3", " 12 1  12 2  8  12 3  6 "},
+            {"=$A$1+a$1*B2", " 14  CPos $A$1 14  CPos A$1 14  CPos B2 2  0 "},
+            {"=\"ab\"\"c\"+A1", " 13 ab\"c endOfString  14  CPos A1 0 "},
+            {"=\"\"", " 13  endOfString "},
+            {"=2^(-1)", " 12 2  12 1  5  4 "},
+            {"=1.5E+3", " 12 1500 "},
+            // Numbers are rounded digit by digit like parseExpression, not correctly
+            {"=1e23", " 12 1.0000000000000001e+23 "},
+            {"=0.0000000000000000000000000001", " 12 1.0000000000000001e-28 "},
+            {"99999999999999999999999999", " 12 1.0000000000000002e+26 "},
+            // Contents without '=' are a number only as a whole, else a string as they are
+            {"42", " 12 42 "},
+            {"-5", " 12 -5 "},
+            {"42 ", " 12 42 "},
+            {"5.", " 12 5 "},
+            {"1e3", " 12 1000 "},
+            {" 42", " 13  42 endOfString "},
+            {"Hello", " 13 Hello endOfString "},
+            {"1.5e", " 13 1.5e endOfString "},
+            {"+5", " 13 +5 endOfString "},
+            {"-", " 13 - endOfString "},
+            {"\"a\"", " 13 \"a\" endOfString "}};
+
+        CParser parser;
+        CStringPool strings;
+        for (const auto &[contents, expected]: cases)
+            assert(compile(parser, strings, contents) == expected);
+
+        // Strings are interned, the formula buffer is reused
+        CStringPool pool;
+        parser.parse("=\"x\"+\"x\"", pool);
+        CFormula formula = parser.takeFormula();
+        assert(formula.size() == 3 && pool.size() == 1);
+        parser.parse("=A1", pool);
+        assert(parser.formula().size() == 1 && formula.size() == 3);
+    }
+
+    static void testErrors() {
+        // Also contents parseExpression fails on by crashing (ranges, functions) or accepts by
+        // reading past their end ("=1<" as "=1")
+        CParser parser;
+        CStringPool strings;
+        for (const char *contents: {"", "=", "=1+", "=+1", "=1==2", "=1!=2", "=(1", "=1)", "=((1)", "=1 2",
+                                    "=\"ab", "=A", "=foo", "=A1B", "=A$$1", "=$1", "=A1$", "=2^-1", "=1e",
+                                    "=1e+", "=.5", "=1..", "=A1:B2", "=sum(A1)", "=1<", "=1>", "=A99999999999"}) {
+            bool failed = false;
+            try {
+                parser.parse(contents, strings);
+            } catch (const invalid_argument &) {
+                failed = true;
+            }
+            assert(failed);
+        }
+
+        // The error shows the contents and marks its position
+        try {
+            parser.parse("=1 2", strings);
+            assert(false);
+        } catch (const invalid_argument &e) {
+            assert(string(e.what()) == "Unexpected extra token(s)\n=1 2\n   ^\n");
+        }
+    }
+
+    // Parentheses and negations of any depth need no recursion
+    static void testDepth() {
+        const size_t depth = 1000000;
+        CParser parser;
+        CStringPool strings;
+        assert(compile(parser, strings, "=" + string(depth, '(') + "1" + string(depth, ')')) == " 12 1 ");
+        parser.parse("=" + string(depth, '-') + "A1", strings);
+        assert(parser.formula().size() == depth + 1);
+    }
+
+    // Formulas equal relative to their cells share a key, anything else tells them apart
+    static void testNormalize() {
+        CParser parser;
+        auto key = [&parser](const string &contents, const char *host) {
+            string key;
+            return parser.normalize(contents, CPos(host), key) ? key : string("none");
+        };
+        assert(key("=B2*C2", "A2") == key("=B3 * C3", "A3"));
+        assert(key("=B2*C2", "A2") == "@~1~0 * @~2~0 ");
+        assert(key("=B2*C2", "A2") != key("=B2*C2", "A3"));
+        assert(key("=$B$2+B$2+$B2", "A1") == "@$1$2 + @~1$2 + @$1~1 ");
+        assert(key("=$B$2", "A1") == key("=$B$2", "Z9") && key("=B$2", "A1") == key("=C$2", "B5"));
+        assert(key("=1 2", "A1") != key("=12", "A1"));
+        assert(key("=\"B2 \"\"\"+A1", "A1") == "\"B2 \"\"\" + @~0~0 "); // strings are kept as they are
+        assert(key("=\"B2\"", "A1") == key("=\"B2\"", "A2"));
+        assert(key("42", "A1") == "none" && key("=\"ab", "A1") == "none" && key("", "A1") == "none");
+    }
+
+    // Contents without '=' get the value their compiled formula has, without compiling it
+    static void testLiterals() {
+        CParser parser;
+        CStringPool strings;
+        mt19937 random(3);
+        const char alphabet[] = "0123456789.eE+- a=";
+        vector<string> cases{"42", "-5", "-0", "42 ", "5.", "1e23", "1e-400", "1e2147483648", " 42", "Hello", "1.5e", "-", "--1", "a=1"};
+        for (int i = 0; i < 100000; i++) {
+            string text(random() % 8 + 1, ' ');
+            for (char &c: text)
+                c = alphabet[random() % (sizeof(alphabet) - 1)];
+            cases.push_back(text);
+        }
+
+        for (const auto &text: cases) {
+            CCellValue value;
+            if (!parser.parseLiteral(text, strings, value)) {
+                assert(text[0] == '=');
+                continue;
+            }
+            parser.parse(text, strings);
+            CCellValue expected = parser.formula().literal();
+            if (expected.isString())
+                assert(value.isString() && &value.str() == &expected.str() && value.str() == text);
+            else
+                assert(!value.isString() && bit_cast<uint64_t>(value.number()) == bit_cast<uint64_t>(expected.number()));
+        }
+
+        CCellValue value;
+        assert(!parser.parseLiteral("", strings, value) && !parser.parseLiteral("=1", strings, value));
+        assert(parser.parseLiteral("-0", strings, value) && signbit(value.number()));
+    }
+};
@@ -4,6 +4,8 @@
 #include <sstream>
 #include <stdexcept>
 #include <random>
+#include <string_view>
+#include <system_error>
 
 using namespace std;
 
@@ -14,6 +16,8 @@ public:
         testEdgeCases();
         testErrorCases();
         testRandomCases();
+        testFromChars();
+        testPacking();
     }
 
 private:
@@ -118,6 +122,92 @@ private:
         expectThrow("A-1"); // negative row
     }
 
+    // Parsing without exceptions stops after the identifier and reports errors by code
+    static void testFromChars() {
+        auto parse = [](string_view str, CPos &pos) {
+            return CPos::fromChars(str.data(), str.data() + str.size(), pos);
+        };
+
+        CPos pos(0, 0);
+        string_view text = "$ab$12+C3";
+        from_chars_result result = parse(text, pos);
+        assert(result.ec == errc() && result.ptr == text.data() + 6);
+        assert(pos.getCol() == 27 && pos.getRow() == 12 && pos.isAbsCol() && pos.isAbsRow());
+
+        for (string_view invalid: {"", "1A", "$$A1", "A", "$1", "AB$", "A-1", "!"}) {
+            CPos unchanged(5, 5);
+            result = parse(invalid, unchanged);
+            assert(result.ec == errc::invalid_argument && result.ptr == invalid.data());
+            assert(unchanged.getCol() == 5 && unchanged.getRow() == 5);
+        }
+        result = parse("A99999999999", pos);
+        assert(result.ec == errc::result_out_of_range);
+        result = parse("ZZZZZZZ1", pos);
+        assert(result.ec == errc::result_out_of_range);
+        assert(parse("A1073741823", pos).ec == errc() && pos.getRow() == CPos::MAX);
+
+        // Column letters both ways, also at compile time
+        static_assert(CPos::columnIndex("A") == 0 && CPos::columnIndex("z") == 25);
+        static_assert(CPos::columnIndex("AA") == 26 && CPos::columnIndex("A1") == -1);
+        constexpr auto letters = [](int col) {
+            char buffer[CPos::COLUMN_LETTERS];
+            return string(buffer, (size_t) CPos::columnLetters(col, buffer));
+        };
+        for (int col: {0, 25, 26, 701, 702, 18277, CPos::MAX}) {
+            string name = letters(col);
+            assert(CPos::columnIndex(name) == col);
+        }
+        assert(letters(701) == "ZZ" && CPos::columnIndex("ZZZZZZZ") == -1);
+    }
+
+    // The packed key keeps the order of the positions, negative ones included
+    static void testPacking() {
+        static_assert(sizeof(CPos) == sizeof(uint64_t));
+        CPos a(-5, 3), b(-5, 4), c(0, CPos::MIN), d(CPos::MAX, CPos::MAX, true, true);
+        assert(a < b && b < c && c < d && !(d < c));
+        assert(d.getCol() == CPos::MAX && d.getRow() == CPos::MAX && d.isAbsCol() && d.isAbsRow());
+        assert(c.getRow() == CPos::MIN && a.getCol() == -5);
+
+        // Equality and hash ignore the absolute flags, the key does not
+        CPos relative("B7"), absolute("$B$7");
+        assert(relative == absolute && relative.hash() == absolute.hash());
+        assert(relative.key() != absolute.key() && !(relative == CPos("B8")));
+
+        mt19937 random(7);
+        for (int i = 0; i < 10000; i++) {
+            int col = (int) (random() % 2001) - 1000, row = (int) (random() % 2001) - 1000;
+            CPos pos(col, row, random() % 2, random() % 2);
+            assert(pos.getCol() == col && pos.getRow() == row);
+            CPos moved = pos;
+            moved.changePosition(3, -4);
+            assert(moved.getCol() == col + (pos.isAbsCol() ? 0 : 3));
+            assert(moved.getRow() == row - (pos.isAbsRow() ? 0 : 4));
+            assert(moved.isAbsCol() == pos.isAbsCol() && moved.isAbsRow() == pos.isAbsRow());
+        }
+
+        // Moves and setters leaving [MIN, MAX] are rejected instead of wrapping around
+        auto rejected = [](auto &&change) {
+            try {
+                change();
+                return false;
+            } catch (const invalid_argument &) {
+                return true;
+            }
+        };
+        CPos edge(CPos::MAX, CPos::MIN);
+        assert(rejected([&] { edge.changePosition(1, 0); }) && rejected([&] { edge.changePosition(0, -1); }));
+        assert(rejected([&] { edge.changePosition(INT32_MIN, 0); }));
+        assert(edge.getCol() == CPos::MAX && edge.getRow() == CPos::MIN);
+        edge.changePosition(CPos::MIN - CPos::MAX, CPos::MAX - CPos::MIN);
+        assert(edge.getCol() == CPos::MIN && edge.getRow() == CPos::MAX);
+        CPos anchored(CPos::MAX, CPos::MAX, true, true);
+        anchored.changePosition(INT32_MAX, INT32_MAX);
+        assert(anchored.getCol() == CPos::MAX && anchored.getRow() == CPos::MAX);
+        assert(rejected([&] { edge.setCol(CPos::MAX + 1); }) && rejected([&] { edge.setRow(INT32_MAX); }));
+        edge.setRow(CPos::MAX);
+        assert(edge.getRow() == CPos::MAX);
+    }
+
     static void testRandomCases() {
         // Test random columns and rows
         random_device rd;
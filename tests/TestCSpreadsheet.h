@@ -3,6 +3,10 @@
 #include <sstream>
 #include <cassert>
 #include <cfloat>
+#include <thread>
+#include <atomic>
+#include <random>
+#include <map>
 
 class TestCSpreadsheet {
 public:
@@ -13,7 +17,24 @@ public:
         testComparisonOperators();
         testStringOperations();
         testReferencesAndCycles();
+        testCycles();
+        testValueCache();
+        testDependencyGraph();
+        testDeepChains();
+        testParallelRecalculation();
+        testColumnBatches();
+        testConcurrentReaders();
+        testStringValues();
         testCopyRect();
+        testOverlappingCopy();
+        testCopyAtEdges();
+        testFillRect();
+        testUndo();
+        testLiterals();
+        testFormulaArena();
+        testSnapshots();
+        testSetCells();
+        testParseCache();
         testSaveLoad();
         testFullWorkflow();
     }
@@ -127,6 +148,387 @@ private:
         assert(holds_alternative<monostate>(valD1));
     }
 
+    // Cycles are found when edits land and listed by getCycles
+    static void testCycles() {
+        // Printed cycles, in the order of their first cells
+        auto cycles = [](const CSpreadsheet &sheet) {
+            set<string> printed;
+            for (const auto &cycle: sheet.getCycles()) {
+                ostringstream os;
+                os << "{";
+                for (const auto &pos: cycle)
+                    os << pos;
+                os << " }";
+                printed.insert(os.str());
+            }
+            string result;
+            for (const auto &cycle: printed)
+                result += cycle;
+            return result;
+        };
+
+        CSpreadsheet sheet;
+        assert(sheet.setCell(CPos("A1"), "=B1"));
+        assert(sheet.setCell(CPos("B1"), "=C1"));
+        assert(sheet.setCell(CPos("D1"), "=A1+1"));
+        assert(cycles(sheet).empty());
+        assert(sheet.setCell(CPos("C1"), "=A1"));
+        assert(sheet.setCell(CPos("E1"), "=E1*2"));
+        assert(cycles(sheet) == "{ CPos A1 CPos B1 CPos C1 }{ CPos E1 }");
+        assert(holds_alternative<monostate>(sheet.getValue(CPos("D1"))));
+
+        // Breaking a cycle
+        assert(sheet.setCell(CPos("B1"), "5"));
+        assert(cycles(sheet) == "{ CPos E1 }");
+        assert(get<double>(sheet.getValue(CPos("D1"))) == 6);
+
+        // A member evaluated while on the cycle is recomputed once the cycle is broken
+        CSpreadsheet broken;
+        assert(broken.setCell(CPos("A1"), "=B1"));
+        assert(broken.setCell(CPos("B1"), "=C1"));
+        assert(broken.setCell(CPos("C1"), "=A1"));
+        assert(holds_alternative<monostate>(broken.getValue(CPos("A1"))));
+        assert(broken.setCell(CPos("C1"), "5"));
+        assert(get<double>(broken.getValue(CPos("A1"))) == 5 && get<double>(broken.getValue(CPos("B1"))) == 5);
+
+        // Two cycles joined by a cell and split again
+        assert(sheet.setCell(CPos("B1"), "=C1+C2"));
+        assert(sheet.setCell(CPos("C2"), "=D2"));
+        assert(sheet.setCell(CPos("D2"), "=C2+B1"));
+        assert(cycles(sheet) == "{ CPos A1 CPos B1 CPos C1 CPos C2 CPos D2 }{ CPos E1 }");
+        assert(sheet.setCell(CPos("B1"), "=C1"));
+        assert(cycles(sheet) == "{ CPos A1 CPos B1 CPos C1 }{ CPos C2 CPos D2 }{ CPos E1 }");
+
+        // Cycles through absolute references list plain cells
+        CSpreadsheet absolute;
+        assert(absolute.setCell(CPos("C5"), "=B5"));
+        assert(absolute.setCell(CPos("B6"), "=$C5"));
+        assert(absolute.setCell(CPos("B5"), "=$B$6"));
+        assert(cycles(absolute) == "{ CPos B5 CPos B6 CPos C5 }");
+        assert(absolute.getCycles()[0][0].key() == CPos("B5").key());
+
+        // Copies and loaded sheets list the same cycles
+        CSpreadsheet copy(sheet);
+        stringstream ss;
+        assert(sheet.save(ss));
+        CSpreadsheet loaded;
+        assert(loaded.load(ss));
+        assert(cycles(copy) == cycles(sheet));
+        assert(cycles(loaded) == cycles(sheet));
+
+        // Random edits of a small graph, checked against the reachability of every pair of cells
+        const int size = 10;
+        CSpreadsheet edited;
+        mt19937 random(7);
+        vector<vector<int> > references(size);
+        for (int edit = 0; edit < 400; edit++) {
+            int cell = (int) (random() % size);
+            references[cell].clear();
+            string formula = "=1";
+            for (unsigned i = random() % 3; i > 0; i--) {
+                int target = (int) (random() % size);
+                references[cell].push_back(target);
+                formula += "+A" + to_string(target + 1);
+            }
+            assert(edited.setCell(CPos(0, cell + 1), formula));
+
+            vector<vector<bool> > reaches(size, vector<bool>(size));
+            for (int from = 0; from < size; from++)
+                for (int to: references[from])
+                    reaches[from][to] = true;
+            for (int via = 0; via < size; via++)
+                for (int from = 0; from < size; from++)
+                    for (int to = 0; to < size; to++)
+                        if (reaches[from][via] && reaches[via][to])
+                            reaches[from][to] = true;
+
+            set<CPos> expected, found;
+            for (int i = 0; i < size; i++)
+                if (reaches[i][i])
+                    expected.insert(CPos(0, i + 1));
+            for (const auto &cycle: edited.getCycles())
+                found.insert(cycle.begin(), cycle.end());
+            assert(found == expected);
+            for (int i = 0; i < size; i++)
+                if (reaches[i][i])
+                    assert(holds_alternative<monostate>(edited.getValue(CPos(0, i + 1))));
+
+            // The cycles found by edits are the cycles found when the sheet is loaded
+            if (edit % 50 == 0) {
+                stringstream saved;
+                assert(edited.save(saved));
+                assert(loaded.load(saved));
+                assert(cycles(loaded) == cycles(edited));
+            }
+        }
+    }
+
+    // Cached values are reused until an edit invalidates them
+    static void testValueCache() {
+        CSpreadsheet sheet;
+
+        assert(sheet.setCell(CPos("A1"), "1"));
+        assert(sheet.setCell(CPos("A2"), "=A1*2"));
+        assert(sheet.setCell(CPos("A3"), "=A2+A1"));
+        assert(get<double>(sheet.getValue(CPos("A3"))) == 3);
+        assert(get<double>(sheet.getValue(CPos("A3"))) == 3); // cached
+
+        // setCell invalidates dependent cells
+        assert(sheet.setCell(CPos("A1"), "10"));
+        assert(get<double>(sheet.getValue(CPos("A3"))) == 30);
+        assert(get<double>(sheet.getValue(CPos("A2"))) == 20);
+
+        // copyRect invalidates dependent cells
+        assert(sheet.setCell(CPos("B1"), "5"));
+        sheet.copyRect(CPos("A1"), CPos("B1"));
+        assert(get<double>(sheet.getValue(CPos("A3"))) == 15);
+
+        // Reading an empty cell does not create it and is not cached as a value
+        assert(holds_alternative<monostate>(sheet.getValue(CPos("Z99"))));
+        assert(sheet.setCell(CPos("C1"), "=Z99+1"));
+        assert(holds_alternative<monostate>(sheet.getValue(CPos("C1"))));
+        assert(sheet.setCell(CPos("Z99"), "1"));
+        assert(get<double>(sheet.getValue(CPos("C1"))) == 2);
+
+        // load replaces all cached values
+        CSpreadsheet other;
+        assert(other.setCell(CPos("A1"), "7"));
+        stringstream ss;
+        assert(other.save(ss));
+        assert(sheet.load(ss));
+        assert(get<double>(sheet.getValue(CPos("A1"))) == 7);
+        assert(holds_alternative<monostate>(sheet.getValue(CPos("A3"))));
+    }
+
+    // Overwritten cells stop depending on their old references
+    static void testDependencyGraph() {
+        CSpreadsheet sheet;
+
+        assert(sheet.setCell(CPos("A1"), "1"));
+        assert(sheet.setCell(CPos("B1"), "2"));
+        assert(sheet.setCell(CPos("C1"), "=A1+A1"));
+        assert(sheet.setCell(CPos("D1"), "=C1*10"));
+        assert(get<double>(sheet.getValue(CPos("D1"))) == 20);
+
+        // Redirect C1 from A1 to B1
+        assert(sheet.setCell(CPos("C1"), "=B1"));
+        assert(get<double>(sheet.getValue(CPos("D1"))) == 20);
+        assert(sheet.setCell(CPos("A1"), "100"));
+        assert(get<double>(sheet.getValue(CPos("D1"))) == 20);
+        assert(sheet.setCell(CPos("B1"), "3"));
+        assert(get<double>(sheet.getValue(CPos("D1"))) == 30);
+
+        // Self reference is cyclic, and so is everything reading it
+        assert(sheet.setCell(CPos("B1"), "=B1+1"));
+        assert(holds_alternative<monostate>(sheet.getValue(CPos("D1"))));
+        assert(sheet.setCell(CPos("B1"), "4"));
+        assert(get<double>(sheet.getValue(CPos("D1"))) == 40);
+
+        // Copied formulas depend on the shifted references
+        sheet.copyRect(CPos("D2"), CPos("D1"));
+        assert(holds_alternative<monostate>(sheet.getValue(CPos("D2"))));
+        assert(sheet.setCell(CPos("C2"), "5"));
+        assert(get<double>(sheet.getValue(CPos("D2"))) == 50);
+    }
+
+    // Long reference chains are evaluated without recursion
+    static void testDeepChains() {
+        const int depth = 200000;
+        CSpreadsheet sheet;
+
+        // A1 = A2 + 1, A2 = A3 + 1, ..., the cell below the chain is empty
+        assert(sheet.setCell(CPos("A1"), "=A2+1"));
+        for (int filled = 1; filled < depth; filled *= 2) {
+            CPos dst("A1");
+            dst.setRow(filled + 1);
+            sheet.copyRect(dst, CPos("A1"), 1, min(filled, depth - filled));
+        }
+        assert(holds_alternative<monostate>(sheet.getValue(CPos("A1"))));
+
+        CPos last("A1");
+        last.setRow(depth);
+        assert(sheet.setCell(last, "0"));
+        assert(get<double>(sheet.getValue(CPos("A1"))) == depth - 1);
+
+        // Closing the chain into a cycle makes every cell of it empty
+        assert(sheet.setCell(last, "=A1"));
+        sheet.recalculate();
+        assert(holds_alternative<monostate>(sheet.getValue(CPos("A1"))));
+        assert(holds_alternative<monostate>(sheet.getValue(CPos("A100"))));
+
+        assert(sheet.setCell(last, "1"));
+        sheet.recalculate();
+        assert(get<double>(sheet.getValue(CPos("A1"))) == depth);
+        assert(get<double>(sheet.getValue(CPos("A100"))) == depth - 99);
+    }
+
+    // Parallel recalculation gives the same values as the serial evaluation
+    static void testParallelRecalculation() {
+        const int rows = 2000;
+        CSpreadsheet serial;
+
+        // Wide levels: inputs, then two independent formulas per row, then a running total
+        assert(serial.setCell(CPos("A1"), "1"));
+        assert(serial.setCell(CPos("B1"), "=A1*2"));
+        assert(serial.setCell(CPos("C1"), "=B1+$A$1"));
+        assert(serial.setCell(CPos("D1"), "=C1"));
+        assert(serial.setCell(CPos("A2"), "=A1+1"));
+        assert(serial.setCell(CPos("D2"), "=D1+C2"));
+        serial.copyRect(CPos("B2"), CPos("B1"), 2, 1);
+        for (int row = 3; row <= rows; row++) {
+            CPos dst("A1");
+            dst.setRow(row);
+            serial.copyRect(dst, CPos("A2"), 4, 1);
+        }
+
+        // A cycle and a cell reading it
+        assert(serial.setCell(CPos("E1"), "=F1"));
+        assert(serial.setCell(CPos("F1"), "=E1"));
+        assert(serial.setCell(CPos("G1"), "=F1+D1"));
+
+        CSpreadsheet parallel(serial);
+        parallel.recalculate(4);
+        for (int row = 1; row <= rows + 1; row++)
+            for (const char *col: {"A", "B", "C", "D", "E", "F", "G"}) {
+                CPos pos(string(col) + "1");
+                pos.setRow(row);
+                assert(valueMatch(serial.getValue(pos), parallel.getValue(pos)));
+            }
+        CPos total("D1");
+        total.setRow(rows);
+        assert(get<double>(parallel.getValue(total)) == 1.0 * rows * (rows + 2));
+
+        // Editing an input recalculates its dependents in parallel as well
+        assert(serial.setCell(CPos("A1"), "2"));
+        assert(parallel.setCell(CPos("A1"), "2"));
+        parallel.recalculate(3);
+        assert(valueMatch(serial.getValue(total), parallel.getValue(total)));
+
+        // The pool of the last call is reused, also after the sheet moved
+        CSpreadsheet moved(std::move(parallel));
+        for (const char *input: {"3", "4"}) {
+            assert(serial.setCell(CPos("A1"), input));
+            assert(moved.setCell(CPos("A1"), input));
+            moved.recalculate(3);
+            assert(valueMatch(serial.getValue(total), moved.getValue(total)));
+        }
+    }
+
+    // Formulas copied down columns are evaluated in batches with the results of single cells
+    static void testColumnBatches() {
+        const int rows = 3000;
+        CSpreadsheet serial;
+        for (int row = 1; row <= rows; row++)
+            assert(serial.setCell(CPos(0, row), to_string(row)));
+        assert(serial.setCell(CPos("B1"), "=A1/C1"));
+        assert(serial.setCell(CPos("C1"), "=A1-10"));
+        assert(serial.setCell(CPos("D1"), "=B1>=$A$2"));
+        assert(serial.setCell(CPos("E1"), "=2^C1"));
+        serial.copyRect(CPos("B2"), CPos("B1"), 4, 1);
+        for (int filled = 2, height; filled < rows; filled += height) {
+            height = min(filled, rows - filled);
+            serial.copyRect(CPos(1, filled + 1), CPos("B1"), 4, height);
+        }
+
+        // Operands that are strings or empty leave the batch
+        assert(serial.setCell(CPos("C5"), "text"));
+        assert(serial.setCell(CPos("C7"), "=Z1"));
+        assert(serial.setCell(CPos(2, rows), "=A1-1"));
+
+        // Evaluated cell by cell, by one recalculate() and by levels: all batched
+        CSpreadsheet recalculated(serial), parallel(serial);
+        recalculated.recalculate();
+        parallel.recalculate(2);
+        for (int row = 1; row <= rows; row += 37) {
+            double lhs = row, rhs = row - 10.0;
+            for (CSpreadsheet *sheet: {&serial, &recalculated}) {
+                assert(get<double>(sheet->getValue(CPos(1, row))) == lhs / rhs);
+                assert(get<double>(sheet->getValue(CPos(2, row))) == rhs);
+                assert(get<double>(sheet->getValue(CPos(3, row))) == (lhs / rhs >= 2.0));
+                assert(get<double>(sheet->getValue(CPos(4, row))) == pow(2.0, rhs));
+            }
+        }
+        for (int row = 1; row <= rows; row++)
+            for (int col = 0; col < 5; col++) {
+                assert(valueMatch(serial.getValue(CPos(col, row)), recalculated.getValue(CPos(col, row))));
+                CValue expected = serial.getValue(CPos(col, row));
+                CValue value = parallel.getValue(CPos(col, row));
+                assert(valueMatch(expected, value));
+                if (holds_alternative<double>(value))
+                    assert(signbit(get<double>(value)) == signbit(get<double>(expected)));
+            }
+        assert(holds_alternative<monostate>(parallel.getValue(CPos("B10")))); // 10 / 0
+        assert(get<double>(parallel.getValue(CPos(1, 11))) == 11.0);
+    }
+
+    // Many threads read (and lazily evaluate) the same sheet at once
+    static void testConcurrentReaders() {
+        const int rows = 500;
+        CSpreadsheet sheet;
+        assert(sheet.setCell(CPos("A1"), "1"));
+        assert(sheet.setCell(CPos("A2"), "=A1+1"));
+        assert(sheet.setCell(CPos("B1"), "=A1*A1"));
+        sheet.copyRect(CPos("B2"), CPos("B1"), 1, 1);
+        for (int row = 3; row <= rows; row++) {
+            CPos dst("A1");
+            dst.setRow(row);
+            sheet.copyRect(dst, CPos("A2"), 2, 1);
+        }
+
+        atomic<int> mismatches{0};
+        vector<thread> readers;
+        for (int t = 0; t < 4; t++)
+            readers.emplace_back([&sheet, &mismatches, t] {
+                for (int i = 0; i < rows; i++) {
+                    // Each thread starts somewhere else, so some of them find dirty cells
+                    int row = (i + t * rows / 4) % rows + 1;
+                    CPos pos("B1");
+                    pos.setRow(row);
+                    CValue value = sheet.getValue(pos);
+                    if (!holds_alternative<double>(value) || get<double>(value) != 1.0 * row * row)
+                        mismatches++;
+                }
+            });
+        for (auto &reader: readers)
+            reader.join();
+        assert(mismatches == 0);
+
+        // Readers running alongside a writer see either the old or the new value
+        thread writer([&sheet] {
+            for (int i = 0; i < 50; i++)
+                assert(sheet.setCell(CPos("A1"), to_string(i % 2 + 1)));
+        });
+        for (int i = 0; i < 200; i++) {
+            double value = get<double>(sheet.getValue(CPos("B3")));
+            assert(value == 9 || value == 16);
+        }
+        writer.join();
+    }
+
+    // Cached strings survive many edits and stay valid in copies of the sheet
+    static void testStringValues() {
+        CSpreadsheet sheet;
+        assert(sheet.setCell(CPos("B1"), "=A1+\"!\""));
+        assert(sheet.setCell(CPos("C1"), "=B1=\"0!\""));
+
+        CSpreadsheet copy;
+        for (int i = 0; i < 5000; i++) {
+            assert(sheet.setCell(CPos("A1"), "text " + to_string(i)));
+            assert(get<string>(sheet.getValue(CPos("B1"))) == "text " + to_string(i) + "!");
+            if (i == 100)
+                copy = sheet;
+        }
+
+        // The copy still reads the strings cached before it was taken
+        assert(get<string>(copy.getValue(CPos("A1"))) == "text 100");
+        assert(get<string>(copy.getValue(CPos("B1"))) == "text 100!");
+        assert(get<double>(sheet.getValue(CPos("C1"))) == 0);
+
+        assert(sheet.setCell(CPos("A1"), "0"));
+        sheet.recalculate();
+        assert(get<double>(sheet.getValue(CPos("C1"))) == 1);
+    }
+
     // Copying ranges of cells
     static void testCopyRect() {
         CSpreadsheet sheet;
@@ -141,6 +543,461 @@ private:
         // Copy formula with adjustment
         sheet.copyRect(CPos("D1"), CPos("B1"));
         assert(get<double>(sheet.getValue(CPos("D1"))) == 6); // references C1
+
+        // Copies save exactly like the formulas typed into their cells
+        CSpreadsheet copied, typed;
+        copied.setCell(CPos("B2"), "=A2*$A$1+\"x\"");
+        copied.copyRect(CPos("C3"), CPos("B2"), 1, 1);
+        copied.copyRect(CPos("B3"), CPos("B2"), 1, 1);
+        typed.setCell(CPos("B2"), "=A2*$A$1+\"x\"");
+        typed.setCell(CPos("C3"), "=B3*$A$1+\"x\"");
+        typed.setCell(CPos("B3"), "=A3*$A$1+\"x\"");
+        ostringstream copiedText, typedText;
+        copied.save(copiedText);
+        typed.save(typedText);
+        assert(copiedText.str() == typedText.str());
+
+        // A column filled with one formula keeps its values when the string pool is rebuilt,
+        // in the sheet and in a copy taken before
+        CSpreadsheet fill;
+        fill.setCell(CPos("A1"), "1");
+        fill.setCell(CPos("A2"), "=A1+1");
+        fill.setCell(CPos("B1"), "=A1+\"-\"");
+        for (int row = 2; row <= 512; row++) {
+            fill.copyRect(CPos(0, row), CPos("A2"));
+            fill.copyRect(CPos(1, row), CPos("B1"));
+        }
+        CSpreadsheet before = fill;
+        for (int i = 0; i < 5000; i++)
+            fill.setCell(CPos("D1"), "text " + to_string(i));
+        fill.recalculate();
+        for (int row = 1; row <= 512; row++) {
+            assert(get<string>(fill.getValue(CPos(1, row))) == to_string(row) + "-");
+            assert(get<string>(before.getValue(CPos(1, row))) == to_string(row) + "-");
+        }
+    }
+
+    // Copies next to CPos::MIN and CPos::MAX are rejected if a cell would leave the range, never wrapped
+    static void testCopyAtEdges() {
+        auto rejected = [](auto &&change) {
+            try {
+                change();
+                return false;
+            } catch (const invalid_argument &) {
+                return true;
+            }
+        };
+
+        CSpreadsheet sheet;
+        assert(sheet.setCell(CPos("A1"), "=B1"));
+        assert(sheet.setCell(CPos("B1"), "=A2+1"));
+        assert(sheet.setCell(CPos("C1"), "=$B$1*2"));
+        assert(sheet.setCell(CPos("A2"), "0"));
+        assert(sheet.setCell(CPos("A5"), "=A4"));
+        assert(sheet.setCell(CPos(CPos::MIN, 0), "7"));
+        assert(sheet.setCell(CPos(CPos::MAX, 0), "5"));
+
+        // A relative reference past MAX would wrap to column MIN
+        assert(rejected([&] { sheet.copyRect(CPos(CPos::MAX, 0), CPos("A1")); }));
+        assert(get<double>(sheet.getValue(CPos(CPos::MAX, 0))) == 5.0);
+        assert(rejected([&] { sheet.copyRect(CPos(CPos::MAX - 1, 0), CPos("A1"), 3, 1); }));
+        assert(rejected([&] { sheet.copyRect(CPos(0, CPos::MIN), CPos("A5")); }));
+        assert(rejected([&] { sheet.fillRect(CPos(CPos::MAX - 3, 1), CPos("A1"), 4, 2); }));
+        assert(rejected([&] { sheet.fillRect(CPos(CPos::MAX - 1, 1), CPos("C1"), 3, 1); }));
+        for (int col: {CPos::MAX - 3, CPos::MAX - 2, CPos::MAX - 1})
+            assert(holds_alternative<monostate>(sheet.getValue(CPos(col, 1))));
+
+        // Up to the edge the copies work, absolute references do not move
+        assert(sheet.setCell(CPos(CPos::MAX, 1), "3"));
+        sheet.copyRect(CPos(CPos::MAX - 1, 0), CPos("A1"));
+        assert(get<double>(sheet.getValue(CPos(CPos::MAX - 1, 0))) == 5.0);
+        sheet.fillRect(CPos(CPos::MAX - 2, 2), CPos("C1"), 3, 2);
+        assert(get<double>(sheet.getValue(CPos(CPos::MAX, 3))) == 2.0);
+        sheet.copyRect(CPos(0, CPos::MIN + 1), CPos("A5"));
+        assert(holds_alternative<monostate>(sheet.getValue(CPos(0, CPos::MIN + 1))));
+        assert(sheet.setCell(CPos(0, CPos::MIN), "4"));
+        assert(get<double>(sheet.getValue(CPos(0, CPos::MIN + 1))) == 4.0);
+    }
+
+    // Overlapping copies read every source cell before overwriting it, as if copied from a snapshot
+    static void testOverlappingCopy() {
+        mt19937 random(3);
+        CSpreadsheet sheet;
+        map<pair<int, int>, double> expected;
+        for (int col = 0; col < 10; col++)
+            for (int row = 0; row < 10; row++)
+                if (random() % 4) {
+                    sheet.setCell(CPos(col, row), to_string(col * 100 + row));
+                    expected[{col, row}] = col * 100 + row;
+                }
+
+        for (int i = 0; i < 200; i++) {
+            int srcCol = (int) (random() % 6), srcRow = (int) (random() % 6);
+            int dstCol = max(srcCol + (int) (random() % 5) - 2, 0), dstRow = max(srcRow + (int) (random() % 5) - 2, 0);
+            int w = (int) (random() % 4) + 1, h = (int) (random() % 4) + 1;
+            map<pair<int, int>, double> copied = expected;
+            for (int col = 0; col < w; col++)
+                for (int row = 0; row < h; row++) {
+                    auto it = expected.find({srcCol + col, srcRow + row});
+                    if (it != expected.end())
+                        copied[{dstCol + col, dstRow + row}] = it->second;
+                    else
+                        copied.erase({dstCol + col, dstRow + row});
+                }
+            expected = copied;
+
+            sheet.copyRect(CPos(dstCol, dstRow), CPos(srcCol, srcRow), w, h);
+            for (int col = 0; col < 12; col++)
+                for (int row = 0; row < 12; row++) {
+                    auto it = expected.find({col, row});
+                    CValue value = sheet.getValue(CPos(col, row));
+                    assert(it == expected.end() ? holds_alternative<monostate>(value) : get<double>(value) == it->second);
+                }
+        }
+
+        // Formulas shifted down over themselves refer to the shifted cells
+        CSpreadsheet formulas;
+        formulas.setCell(CPos("A1"), "1");
+        formulas.setCell(CPos("A2"), "=A1+1");
+        formulas.setCell(CPos("A3"), "=A2*10");
+        formulas.copyRect(CPos("A3"), CPos("A2"), 1, 2);
+        formulas.copyRect(CPos("A2"), CPos("A1"), 1, 1);
+        assert(get<double>(formulas.getValue(CPos("A2"))) == 1);
+        assert(get<double>(formulas.getValue(CPos("A3"))) == 2 && get<double>(formulas.getValue(CPos("A4"))) == 20);
+    }
+
+    // Values of the cells of the region used by testUndo
+    static vector<CValue> values(CSpreadsheet &sheet) {
+        vector<CValue> result;
+        for (int col = 0; col < 8; col++)
+            for (int row = 0; row < 8; row++)
+                result.push_back(sheet.getValue(CPos(col, row)));
+        return result;
+    }
+
+    // Undoing edits gives back the values of snapshots taken before them, redoing the ones after
+    static void testUndo() {
+        mt19937 random(8);
+        auto randomPos = [&random] { return CPos((int) (random() % 6), (int) (random() % 6)); };
+        auto name = [](CPos pos) { return string(1, char('A' + pos.getCol())) + to_string(pos.getRow()); };
+
+        CSpreadsheet sheet;
+        vector<vector<CValue> > states{values(sheet)};
+        for (int i = 0; i < 300; i++) {
+            CPos pos = randomPos(), other = randomPos();
+            switch (random() % 5) {
+                case 0:
+                    sheet.setCell(pos, to_string(i));
+                    break;
+                case 1:
+                    sheet.setCell(pos, "=" + name(other) + "+1");
+                    break;
+                case 2:
+                    sheet.setCell(pos, "=" + name(other) + "+\"s" + to_string(i) + "\"");
+                    break;
+                case 3:
+                    sheet.copyRect(pos, other, (int) (random() % 3) + 1, (int) (random() % 3) + 1);
+                    break;
+                default: {
+                    vector<pair<CPos, string> > cells{{pos, to_string(-i)}, {other, "=" + name(pos) + "*2"}};
+                    sheet.setCells(cells);
+                }
+            }
+            states.push_back(values(sheet));
+        }
+
+        // Undo all the way, redo half of it, then branch off
+        for (size_t i = states.size() - 1; i > 0; i--) {
+            assert(sheet.undo());
+            assert(values(sheet) == states[i - 1]);
+        }
+        assert(!sheet.undo());
+        for (size_t i = 1; i <= 150; i++) {
+            assert(sheet.redo());
+            assert(values(sheet) == states[i]);
+        }
+        sheet.fillRect(CPos("A1"), CPos("B2"), 3, 3);
+        assert(!sheet.redo() && sheet.undo() && values(sheet) == states[150]);
+
+        // The history survives collections of the arena and the string pool
+        CSpreadsheet churn;
+        churn.setCell(CPos("A1"), "=\"first\"+1");
+        churn.setCell(CPos("A1"), "text");
+        for (int i = 0; i < 20000; i++)
+            churn.setCell(CPos("B1"), "=A1+\"" + to_string(i) + "\"");
+        churn.recalculate();
+        for (int i = 0; i < 20000; i++)
+            assert(churn.undo());
+        assert(get<string>(churn.getValue(CPos("A1"))) == "text" && churn.undo());
+        assert(get<string>(churn.getValue(CPos("A1"))) == "first1" && churn.undo() && !churn.undo());
+        assert(holds_alternative<monostate>(churn.getValue(CPos("A1"))));
+        assert(churn.redo() && churn.redo() && get<string>(churn.getValue(CPos("A1"))) == "text");
+
+        // Copies and loaded sheets start without history, no limit keeps none
+        CSpreadsheet copy = sheet;
+        assert(!copy.undo() && sheet.undo());
+        stringstream ss;
+        assert(churn.save(ss) && sheet.load(ss) && !sheet.undo());
+        sheet.setUndoLimit(0);
+        sheet.setCell(CPos("A1"), "1");
+        assert(!sheet.undo());
+    }
+
+    // A block repeated over a rectangle, with references adjusted for every cell
+    static void testFillRect() {
+        CSpreadsheet sheet;
+        sheet.setCell(CPos("A1"), "1");
+        sheet.setCell(CPos("A2"), "=A1+1");
+        sheet.setCell(CPos("B1"), "=A1*$A$1*2");
+        sheet.fillRect(CPos("A2"), CPos("A2"), 1, 9999);
+        sheet.fillRect(CPos("B1"), CPos("B1"), 1, 10000);
+        for (int row = 1; row <= 10000; row++)
+            assert(get<double>(sheet.getValue(CPos(1, row))) == 2 * row);
+
+        // A 2 x 2 block tiled over 6 x 5 cells, the source block is inside the rectangle
+        CSpreadsheet tiles;
+        tiles.setCell(CPos("D4"), "10");
+        tiles.setCell(CPos("E4"), "x");
+        tiles.setCell(CPos("D5"), "=D4+1");
+        tiles.fillRect(CPos("B2"), CPos("D4"), 6, 5, 2, 2);
+        for (int col = 1; col < 7; col++)
+            for (int row = 2; row < 7; row++) {
+                CValue value = tiles.getValue(CPos(col, row));
+                if (col % 2)
+                    assert(row % 2 ? get<double>(value) == 11 : get<double>(value) == 10);
+                else
+                    assert(row % 2 ? holds_alternative<monostate>(value) : get<string>(value) == "x");
+            }
+        assert(holds_alternative<monostate>(tiles.getValue(CPos("B7"))));
+    }
+
+    // Numbers and strings are stored apart from formulas, edits switch a cell between the two
+    static void testLiterals() {
+        CSpreadsheet sheet;
+        sheet.setCell(CPos("A1"), "2");
+        sheet.setCell(CPos("B1"), "=A1*10");
+        assert(get<double>(sheet.getValue(CPos("B1"))) == 20);
+
+        // Dependents of a literal are invalidated when it changes, also into a formula and back
+        sheet.setCell(CPos("A1"), "3");
+        assert(get<double>(sheet.getValue(CPos("B1"))) == 30);
+        sheet.setCell(CPos("A1"), "=1+C1");
+        sheet.setCell(CPos("C1"), "4");
+        assert(get<double>(sheet.getValue(CPos("B1"))) == 50);
+        sheet.setCell(CPos("A1"), "text");
+        assert(holds_alternative<monostate>(sheet.getValue(CPos("B1"))));
+        assert(get<string>(sheet.getValue(CPos("A1"))) == "text");
+
+        // A literal breaks the cycle its cell was on
+        sheet.setCell(CPos("D1"), "=E1");
+        sheet.setCell(CPos("E1"), "=D1");
+        assert(sheet.getCycles().size() == 1);
+        sheet.setCell(CPos("E1"), "5");
+        assert(sheet.getCycles().empty());
+        assert(get<double>(sheet.getValue(CPos("D1"))) == 5);
+
+        // Copying a literal copies the value, strings survive a rebuild of the string pool
+        sheet.copyRect(CPos("A10"), CPos("A1"), 3, 1);
+        assert(get<string>(sheet.getValue(CPos("A10"))) == "text");
+        assert(holds_alternative<monostate>(sheet.getValue(CPos("B10"))));
+        assert(get<double>(sheet.getValue(CPos("C10"))) == 4);
+        sheet.setCell(CPos("A10"), "7");
+        assert(get<double>(sheet.getValue(CPos("B10"))) == 70);
+        for (int i = 0; i < 5000; i++)
+            sheet.setCell(CPos("G1"), "text " + to_string(i));
+        sheet.recalculate();
+        assert(get<string>(sheet.getValue(CPos("A1"))) == "text");
+        assert(get<string>(sheet.getValue(CPos("G1"))) == "text 4999");
+
+        // Literals and formulas save together and load back into their own storage
+        sheet.setCell(CPos("H1"), "0.1");
+        sheet.setCell(CPos("H2"), "=H1+H1");
+        stringstream ss;
+        assert(sheet.save(ss));
+        CSpreadsheet loaded;
+        assert(loaded.load(ss));
+        assert(get<double>(loaded.getValue(CPos("H2"))) == 0.2);
+        assert(get<double>(loaded.getValue(CPos("D1"))) == 5);
+        assert(get<string>(loaded.getValue(CPos("A1"))) == "text");
+        assert(get<double>(loaded.getValue(CPos("B10"))) == 70);
+        loaded.setCell(CPos("H1"), "1");
+        assert(get<double>(loaded.getValue(CPos("H2"))) == 2);
+    }
+
+    // Formulas keep their instructions when the arena is collected, also in copies of the sheet
+    static void testFormulaArena() {
+        CSpreadsheet sheet;
+        sheet.setCell(CPos("A1"), "2");
+        sheet.setCell(CPos("B1"), "=A1*\"x\"");
+        sheet.setCell(CPos("B2"), "=$A$1^10");
+        sheet.copyRect(CPos("C1"), CPos("B1"), 1, 2);
+        CSpreadsheet before = sheet;
+
+        // The replaced formulas fill the arena until it is collected, several times
+        for (int i = 0; i < 30000; i++)
+            sheet.setCell(CPos("D1"), "=A1+" + to_string(i));
+        assert(get<double>(sheet.getValue(CPos("D1"))) == 30001);
+        assert(get<double>(sheet.getValue(CPos("B2"))) == 1024);
+        assert(holds_alternative<monostate>(sheet.getValue(CPos("C1"))));
+        sheet.setCell(CPos("B1"), "=A1+1");
+        sheet.setCell(CPos("B1"), "=A1+1");
+        assert(get<double>(before.getValue(CPos("B2"))) == 1024);
+        assert(get<double>(before.getValue(CPos("C2"))) == 1024);
+
+        // A sheet moved away from leaves a usable one
+        CSpreadsheet moved(std::move(before));
+        before.setCell(CPos("A1"), "1");
+        before.setCell(CPos("A2"), "=A1+1");
+        assert(get<double>(before.getValue(CPos("A2"))) == 2);
+        assert(get<double>(moved.getValue(CPos("B2"))) == 1024);
+
+        // Loaded sheets place their formulas in a new arena
+        stringstream ss;
+        assert(sheet.save(ss));
+        CSpreadsheet loaded = sheet;
+        assert(loaded.load(ss));
+        assert(get<double>(loaded.getValue(CPos("B1"))) == 3 && get<double>(loaded.getValue(CPos("D1"))) == 30001);
+    }
+
+    // Copies share the cells until they change, edits on either side stay there
+    static void testSnapshots() {
+        CSpreadsheet sheet;
+        for (int row = 1; row <= 200; row++) {
+            sheet.setCell(CPos(0, row), to_string(row));
+            sheet.setCell(CPos(1, row), "=A" + to_string(row) + "*2");
+        }
+        sheet.setCell(CPos("C1"), "=C2");
+        sheet.setCell(CPos("C2"), "=C1");
+        assert(get<double>(sheet.getValue(CPos("B100"))) == 200);
+
+        // Taken with evaluated and with dirty cells
+        CSpreadsheet evaluated = sheet;
+        sheet.setCell(CPos("A100"), "1");
+        CSpreadsheet dirty = sheet;
+        sheet.setCell(CPos("A100"), "\"text\"");
+        sheet.setCell(CPos("C2"), "5");
+        dirty.setCell(CPos("B1"), "=A200+1");
+
+        assert(get<double>(evaluated.getValue(CPos("B100"))) == 200);
+        assert(get<double>(dirty.getValue(CPos("B100"))) == 2);
+        assert(get<double>(dirty.getValue(CPos("B1"))) == 201);
+        assert(holds_alternative<monostate>(dirty.getValue(CPos("C1"))));
+        assert(holds_alternative<monostate>(sheet.getValue(CPos("B100"))));
+        assert(get<double>(sheet.getValue(CPos("B1"))) == 2);
+        assert(get<double>(sheet.getValue(CPos("C1"))) == 5);
+        assert(holds_alternative<monostate>(evaluated.getValue(CPos("C1"))));
+
+        // The snapshot keeps working as a sheet of its own
+        evaluated.setCell(CPos("A1"), "10");
+        assert(get<double>(evaluated.getValue(CPos("B1"))) == 20);
+        assert(get<double>(sheet.getValue(CPos("B1"))) == 2 && get<double>(dirty.getValue(CPos("B1"))) == 201);
+
+        // Snapshots of one sheet edited on different threads (run under -fsanitize=thread, see make tsan)
+        vector<CSpreadsheet> snapshots(4, evaluated);
+        vector<thread> editors;
+        for (int t = 0; t < (int) snapshots.size(); t++)
+            editors.emplace_back([&snapshot = snapshots[t], t] {
+                for (int row = 1; row <= 200; row += 3) {
+                    assert(snapshot.setCell(CPos(0, row), to_string(row + t)));
+                    assert(snapshot.setCell(CPos(3, row), "=B" + to_string(row) + "+\"" + to_string(t) + "\""));
+                }
+                snapshot.copyRect(CPos("E1"), CPos("A1"), 2, 50);
+                snapshot.recalculate();
+            });
+        evaluated.setCell(CPos("A2"), "0");
+        for (auto &editor: editors)
+            editor.join();
+        for (int t = 0; t < (int) snapshots.size(); t++) {
+            assert(get<double>(snapshots[t].getValue(CPos("B4"))) == 2 * (4 + t));
+            assert(get<double>(snapshots[t].getValue(CPos("F4"))) == 2 * (4 + t));
+            assert(get<string>(snapshots[t].getValue(CPos("D4"))) == to_string(2 * (4 + t)) + to_string(t));
+        }
+        assert(get<double>(evaluated.getValue(CPos("B4"))) == 8 && get<double>(evaluated.getValue(CPos("B2"))) == 0);
+    }
+
+    // A batch of edits gives the same values and cycles as the edits one by one
+    static void testSetCells() {
+        mt19937 random(11);
+        auto randomPos = [&random] { return CPos((int) (random() % 8), (int) (random() % 8) + 1); };
+        auto name = [](CPos pos) { return string(1, char('A' + pos.getCol())) + to_string(pos.getRow()); };
+
+        CSpreadsheet single, batched;
+        for (int round = 0; round < 40; round++) {
+            vector<pair<CPos, string> > cells;
+            for (int i = 0; i < 30; i++) {
+                CPos pos = randomPos();
+                switch (random() % 4) {
+                    case 0:
+                        cells.emplace_back(pos, to_string(random() % 100));
+                        break;
+                    case 1:
+                        cells.emplace_back(pos, "\"s" + to_string(i) + "\"");
+                        break;
+                    default:
+                        cells.emplace_back(pos, "=" + name(randomPos()) + "+" + name(randomPos()));
+                }
+            }
+            for (const auto &[pos, contents]: cells)
+                assert(single.setCell(pos, contents));
+            assert(batched.setCells(cells, round % 2 ? 4 : 1));
+
+            vector<vector<CPos> > singleCycles = single.getCycles(), batchedCycles = batched.getCycles();
+            sort(singleCycles.begin(), singleCycles.end());
+            sort(batchedCycles.begin(), batchedCycles.end());
+            assert(singleCycles == batchedCycles);
+            for (int col = 0; col < 8; col++)
+                for (int row = 1; row <= 8; row++)
+                    assert(single.getValue(CPos(col, row)) == batched.getValue(CPos(col, row)));
+        }
+
+        // An invalid entry leaves the sheet unchanged, a later entry of a cell wins
+        CSpreadsheet sheet;
+        vector<pair<CPos, string> > cells{{CPos("A1"), "1"}, {CPos("A2"), "=A1+1"}, {CPos("A1"), "5"}};
+        assert(sheet.setCells(cells));
+        assert(get<double>(sheet.getValue(CPos("A1"))) == 5 && get<double>(sheet.getValue(CPos("A2"))) == 6);
+        cells = {{CPos("A1"), "7"}, {CPos("A3"), "=A1+"}};
+        assert(!sheet.setCells(cells));
+        assert(get<double>(sheet.getValue(CPos("A2"))) == 6 && holds_alternative<monostate>(sheet.getValue(CPos("A3"))));
+        assert(sheet.setCells({}));
+    }
+
+    // Formulas filled down a column are parsed once, with or without the cache the values are the same
+    static void testParseCache() {
+        CSpreadsheet cached, uncached;
+        uncached.setParseCacheLimit(0);
+        for (CSpreadsheet *sheet: {&cached, &uncached}) {
+            vector<pair<CPos, string> > cells;
+            for (int row = 1; row <= 100; row++) {
+                string r = to_string(row);
+                sheet->setCell(CPos(0, row), r);
+                sheet->setCell(CPos(1, row), "=A" + r + "*$A$1+\"x\"");
+                cells.emplace_back(CPos(2, row), "=A" + r + "*2");
+                cells.emplace_back(CPos(3, row), "=C" + r + " + 1");
+            }
+            cells.emplace_back(CPos("E1"), "=1+2");
+            cells.emplace_back(CPos("E2"), "=1+2");
+            assert(sheet->setCells(cells));
+        }
+        for (int col = 0; col < 5; col++)
+            for (int row = 1; row <= 100; row++)
+                assert(cached.getValue(CPos(col, row)) == uncached.getValue(CPos(col, row)));
+        assert(get<double>(cached.getValue(CPos("D50"))) == 101 && get<double>(cached.getValue(CPos("E2"))) == 3);
+
+        // One miss per formula column, constant formulas are not cached
+        CParseCache::CStats stats = cached.parseCacheStats();
+        assert(stats.m_Misses == 5 && stats.m_Hits == 297 && stats.hitRate() > 0.98);
+        assert(uncached.parseCacheStats().m_Hits == 0 && uncached.parseCacheStats().m_Misses == 0);
+
+        // Cached formulas survive collections, copies start without them
+        for (int i = 0; i < 30000; i++)
+            cached.setCell(CPos("F1"), "=A1+" + to_string(i % 3000));
+        cached.setCell(CPos("B101"), "=A101*$A$1+\"x\"");
+        CSpreadsheet copy = cached;
+        copy.setCell(CPos("B102"), "=A102*$A$1+\"x\"");
+        assert(cached.getValue(CPos("B101")) == uncached.getValue(CPos("B101")));
+        assert(copy.getValue(CPos("B102")) == uncached.getValue(CPos("B102")));
+        assert(cached.getValue(CPos("B100")) == uncached.getValue(CPos("B100")));
+        assert(copy.parseCacheStats().m_Hits == 0 && cached.parseCacheStats().m_Hits > stats.m_Hits + 27000);
     }
 
     // Saving and loading the spreadsheet
@@ -278,6 +1135,13 @@ private:
         iss.str(data);
 
         assert(!x1.load(iss));
+
+        // A malformed position fails the load instead of throwing
+        for (string bad: {"CPos A1 VectorLen 1 14 CPos 1A ", "CPos A-1 VectorLen 1 0 5 "}) {
+            iss.clear();
+            iss.str(bad);
+            assert(!x1.load(iss));
+        }
         assert(x0.setCell(CPos("D0"), "10"));
         assert(x0.setCell(CPos("D1"), "20"));
         assert(x0.setCell(CPos("D2"), "30"));